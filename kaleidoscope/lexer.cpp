@@ -1,7 +1,19 @@
-#include <memory>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
 #include <string>
+#include <unistd.h>
+#include <utility>
 #include <vector>
 
+extern "C"
+{
+#include "../allocator/arena.h"
+}
+
 // ---- Lexer ---- //
 
 enum Token
@@ -73,12 +85,133 @@ static int gettok()
 
 // ---- Parser State variables ---- //
 
+// Token the parser is looking at
+static int CurTok;
+static int getNextToken() { return CurTok = gettok(); }
+
+// Precedence of every binary operator, 0 for characters that aren't one
+static int BinopPrecedence[256];
+
+static int GetTokPrecedence()
+{
+    if (CurTok < 0 || CurTok > 255)
+        return -1;
+
+    int TokPrec = BinopPrecedence[CurTok];
+    if (TokPrec <= 0)
+        return -1;
+    return TokPrec;
+}
+
+// ---- AST Arena ---- //
+
+// Every node, argument list and identifier is pushed to AstArena. Nodes only
+// hold numbers and pointers into the arena, so none of them is ever destroyed
+// on its own and parsing costs one commit per arena chunk instead of a
+// malloc per node
+static mem_arena* AstArena;
+
+static void* astPush(u64 Size)
+{
+    void* Mem = arena_push(AstArena, Size, true);
+    if (!Mem)
+    {
+        fprintf(stderr, "Error: out of AST memory\n");
+        exit(1);
+    }
+    return Mem;
+}
+
+template <typename T, typename... Args> static T* newNode(Args&&... args)
+{
+    return new (astPush(sizeof(T))) T(std::forward<Args>(args)...);
+}
+
+// Copies the list a parser collected on one of its stacks into the arena
+template <typename T> static T* astArray(const T* Src, size_t N)
+{
+    if (N == 0)
+        return nullptr;
+    T* Dst = (T*)astPush(sizeof(T) * N);
+    memcpy(Dst, Src, sizeof(T) * N);
+    return Dst;
+}
+
+// ---- Identifiers ---- //
+
+// Open addressing set of every identifier seen. Each spelling is stored once
+// in the arena, so names are compared by pointer after interning
+static struct
+{
+    const char** Slots;
+    u32 Cap; // power of two
+    u32 Count;
+} Names;
+
+static u32 hashName(const char* S, size_t Len)
+{
+    u32 H = 2166136261u; // FNV-1a
+    for (size_t I = 0; I < Len; I++)
+        H = (H ^ (unsigned char)S[I]) * 16777619u;
+    return H;
+}
+
+static void growNames()
+{
+    u32 Cap = Names.Cap ? Names.Cap * 2 : 1024;
+    const char** Slots = (const char**)calloc(Cap, sizeof(const char*));
+    if (!Slots)
+    {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+    for (u32 I = 0; I < Names.Cap; I++)
+    {
+        const char* Name = Names.Slots[I];
+        if (!Name)
+            continue;
+        u32 J = hashName(Name, strlen(Name)) & (Cap - 1);
+        while (Slots[J])
+            J = (J + 1) & (Cap - 1);
+        Slots[J] = Name;
+    }
+    free(Names.Slots);
+    Names.Slots = Slots;
+    Names.Cap = Cap;
+}
+
+// The one copy of S[0, Len), added the first time it is seen
+static const char* intern(const char* S, size_t Len)
+{
+    // At most half full, so probes stay short
+    if (2 * (Names.Count + 1) > Names.Cap)
+        growNames();
+
+    u32 I = hashName(S, Len) & (Names.Cap - 1);
+    while (const char* Name = Names.Slots[I])
+    {
+        if (strncmp(Name, S, Len) == 0 && Name[Len] == '\0')
+            return Name;
+        I = (I + 1) & (Names.Cap - 1);
+    }
+
+    char* Name = (char*)astPush(Len + 1);
+    memcpy(Name, S, Len);
+    Name[Len] = '\0';
+    Names.Slots[I] = Name;
+    Names.Count++;
+    return Name;
+}
+
+static const char* intern(const std::string& S)
+{
+    return intern(S.data(), S.size());
+}
+
 // ---- AST ---- //
 
 class ExprAST
 {
-  public:
-    virtual ~ExprAST() = default;
 };
 
 class NumberExprAST : public ExprAST
@@ -86,64 +219,423 @@ class NumberExprAST : public ExprAST
     double Val;
 
   public:
-    NumberExprAST(double VAL) : Val(Val) {}
+    NumberExprAST(double Val) : Val(Val) {}
 };
 
 class VariableExprAst : public ExprAST
 {
-    std::string Name;
+    const char* Name; // interned
 
   public:
-    VariableExprAst(const std::string& Name) : Name(Name) {}
+    VariableExprAst(const char* Name) : Name(Name) {}
 };
 
 class BinaryExprAST : public ExprAST
 {
     char Op;
-    std::unique_ptr<ExprAST> LHS, RHS;
+    ExprAST *LHS, *RHS;
 
   public:
-    BinaryExprAST(char Op, std::unique_ptr<ExprAST> LHS,
-                  std::unique_ptr<ExprAST> RHS)
-        : Op(Op), LHS(std::move(LHS)), RHS(std::move(RHS))
+    BinaryExprAST(char Op, ExprAST* LHS, ExprAST* RHS)
+        : Op(Op), LHS(LHS), RHS(RHS)
     {
     }
 };
 
 class CallExprAST : public ExprAST
 {
-    std::string Callee;
-    std::vector<std::unique_ptr<ExprAST>> Args;
+    const char* Callee; // interned
+    ExprAST** Args;
+    unsigned NumArgs;
 
   public:
-    CallExprAST(const std::string& Callee,
-                std::vector<std::unique_ptr<ExprAST>> Args)
-        : Callee(Callee), Args(std::move(Args))
+    CallExprAST(const char* Callee, ExprAST** Args, unsigned NumArgs)
+        : Callee(Callee), Args(Args), NumArgs(NumArgs)
     {
     }
 };
 
 class PrototypeAST
 {
-    std::string Name;
-    std::vector<std::string> Args;
+    const char* Name; // interned
+    const char** Args;
+    unsigned NumArgs;
 
   public:
-    PrototypeAST(const std::string& Name, std::vector<std::string> Args)
-        : Name(Name), Args(std::move(Args))
+    PrototypeAST(const char* Name, const char** Args, unsigned NumArgs)
+        : Name(Name), Args(Args), NumArgs(NumArgs)
     {
     }
 };
 
 class FunctionAst
 {
-    std::unique_ptr<PrototypeAST> Proto;
-    std::unique_ptr<ExprAST> Body;
+    PrototypeAST* Proto;
+    ExprAST* Body;
 
   public:
-    FunctionAst(std::unique_ptr<PrototypeAST> Proto,
-                std::unique_ptr<ExprAST> Body)
-        : Proto(std::move(Proto)), Body(std::move(Body))
+    FunctionAst(PrototypeAST* Proto, ExprAST* Body) : Proto(Proto), Body(Body)
     {
     }
 };
+
+// ---- Parser ---- //
+
+// Lists being parsed, nested calls push on top of the outer ones. They stop
+// growing once they fit the longest list, finished lists move to the arena
+static std::vector<ExprAST*> ArgStack;
+static std::vector<const char*> NameStack;
+
+static ExprAST* LogError(const char* Str)
+{
+    fprintf(stderr, "Error: %s\n", Str);
+    return nullptr;
+}
+
+static PrototypeAST* LogErrorP(const char* Str)
+{
+    LogError(Str);
+    return nullptr;
+}
+
+static ExprAST* ParseExpression();
+
+// numberexpr ::= number
+static ExprAST* ParseNumberExpr()
+{
+    ExprAST* Result = newNode<NumberExprAST>(NumVal);
+    getNextToken(); // consume the number
+    return Result;
+}
+
+// parenexpr ::= '(' expression ')'
+static ExprAST* ParseParenExpr()
+{
+    getNextToken(); // eat (
+    ExprAST* V = ParseExpression();
+    if (!V)
+        return nullptr;
+
+    if (CurTok != ')')
+        return LogError("expected ')'");
+    getNextToken(); // eat )
+    return V;
+}
+
+// identifierexpr
+//   ::= identifier
+//   ::= identifier '(' expression* ')'
+static ExprAST* ParseIdentifierExpr()
+{
+    const char* IdName = intern(IdentifierStr);
+
+    getNextToken(); // eat identifier
+
+    if (CurTok != '(') // Simple variable ref
+        return newNode<VariableExprAst>(IdName);
+
+    // Call
+    getNextToken(); // eat (
+    size_t Base = ArgStack.size();
+    if (CurTok != ')')
+    {
+        while (true)
+        {
+            ExprAST* Arg = ParseExpression();
+            if (!Arg)
+            {
+                ArgStack.resize(Base);
+                return nullptr;
+            }
+            ArgStack.push_back(Arg);
+
+            if (CurTok == ')')
+                break;
+
+            if (CurTok != ',')
+            {
+                ArgStack.resize(Base);
+                return LogError("Expected ')' or ',' in argument list");
+            }
+            getNextToken();
+        }
+    }
+
+    // Eat the ')'
+    getNextToken();
+
+    unsigned NumArgs = ArgStack.size() - Base;
+    ExprAST** Args = astArray(ArgStack.data() + Base, NumArgs);
+    ArgStack.resize(Base);
+    return newNode<CallExprAST>(IdName, Args, NumArgs);
+}
+
+// primary
+//   ::= identifierexpr
+//   ::= numberexpr
+//   ::= parenexpr
+static ExprAST* ParsePrimary()
+{
+    switch (CurTok)
+    {
+    default:
+        return LogError("unknown token when expecting an expression");
+    case tok_identifier:
+        return ParseIdentifierExpr();
+    case tok_number:
+        return ParseNumberExpr();
+    case '(':
+        return ParseParenExpr();
+    }
+}
+
+// binoprhs
+//   ::= ('+' primary)*
+static ExprAST* ParseBinOpRHS(int ExprPrec, ExprAST* LHS)
+{
+    // If this is a binop, find its precedence
+    while (true)
+    {
+        int TokPrec = GetTokPrecedence();
+
+        // If this is a binop that binds at least as tightly as the current
+        // binop, consume it, otherwise we are done
+        if (TokPrec < ExprPrec)
+            return LHS;
+
+        int BinOp = CurTok;
+        getNextToken(); // eat binop
+
+        // Parse the primary expression after the binary operator
+        ExprAST* RHS = ParsePrimary();
+        if (!RHS)
+            return nullptr;
+
+        // If BinOp binds less tightly with RHS than the operator after RHS,
+        // let the pending operator take RHS as its LHS
+        int NextPrec = GetTokPrecedence();
+        if (TokPrec < NextPrec)
+        {
+            RHS = ParseBinOpRHS(TokPrec + 1, RHS);
+            if (!RHS)
+                return nullptr;
+        }
+
+        // Merge LHS/RHS
+        LHS = newNode<BinaryExprAST>(BinOp, LHS, RHS);
+    }
+}
+
+// expression
+//   ::= primary binoprhs
+static ExprAST* ParseExpression()
+{
+    ExprAST* LHS = ParsePrimary();
+    if (!LHS)
+        return nullptr;
+
+    return ParseBinOpRHS(0, LHS);
+}
+
+// prototype
+//   ::= id '(' id* ')'
+static PrototypeAST* ParsePrototype()
+{
+    if (CurTok != tok_identifier)
+        return LogErrorP("Expected function name in prototype");
+
+    const char* FnName = intern(IdentifierStr);
+    getNextToken();
+
+    if (CurTok != '(')
+        return LogErrorP("Expected '(' in prototype");
+
+    // Read the list of argument names
+    size_t Base = NameStack.size();
+    while (getNextToken() == tok_identifier)
+        NameStack.push_back(intern(IdentifierStr));
+    unsigned NumArgs = NameStack.size() - Base;
+    const char** ArgNames = astArray(NameStack.data() + Base, NumArgs);
+    NameStack.resize(Base);
+
+    if (CurTok != ')')
+        return LogErrorP("Expected ')' in prototype");
+
+    // success
+    getNextToken(); // eat ')'
+
+    return newNode<PrototypeAST>(FnName, ArgNames, NumArgs);
+}
+
+// definition ::= 'def' prototype expression
+static FunctionAst* ParseDefinition()
+{
+    getNextToken(); // eat def
+    PrototypeAST* Proto = ParsePrototype();
+    if (!Proto)
+        return nullptr;
+
+    if (ExprAST* E = ParseExpression())
+        return newNode<FunctionAst>(Proto, E);
+    return nullptr;
+}
+
+// toplevelexpr ::= expression
+static FunctionAst* ParseTopLevelExpr()
+{
+    if (ExprAST* E = ParseExpression())
+    {
+        // Make an anonymous proto
+        PrototypeAST* Proto =
+            newNode<PrototypeAST>(intern("__anon_expr", 11), nullptr, 0);
+        return newNode<FunctionAst>(Proto, E);
+    }
+    return nullptr;
+}
+
+// external ::= 'extern' prototype
+static PrototypeAST* ParseExtern()
+{
+    getNextToken(); // eat extern
+    return ParsePrototype();
+}
+
+// ---- Top-Level parsing ---- //
+
+// Prompts and a line per parsed item only when typing at a terminal, a piped
+// program just gets the totals at the end
+static bool Interactive;
+
+static struct
+{
+    long Definitions;
+    long Externs;
+    long Expressions;
+    long Errors;
+} Parsed;
+
+static void HandleDefinition()
+{
+    if (ParseDefinition())
+    {
+        Parsed.Definitions++;
+        if (Interactive)
+            fprintf(stderr, "Parsed a function definition.\n");
+    }
+    else
+    {
+        Parsed.Errors++;
+        // Skip token for error recovery.
+        getNextToken();
+    }
+}
+
+static void HandleExtern()
+{
+    if (ParseExtern())
+    {
+        Parsed.Externs++;
+        if (Interactive)
+            fprintf(stderr, "Parsed an extern\n");
+    }
+    else
+    {
+        Parsed.Errors++;
+        // Skip token for error recovery.
+        getNextToken();
+    }
+}
+
+static void HandleTopLevelExpression()
+{
+    // Evaluate a top-level expression into an anonymous function.
+    if (ParseTopLevelExpr())
+    {
+        Parsed.Expressions++;
+        if (Interactive)
+            fprintf(stderr, "Parsed a top-level expr\n");
+    }
+    else
+    {
+        Parsed.Errors++;
+        // Skip token for error recovery.
+        getNextToken();
+    }
+}
+
+// top ::= definition | external | expression | ';'
+static void MainLoop()
+{
+    while (true)
+    {
+        if (Interactive)
+            fprintf(stderr, "ready> ");
+        switch (CurTok)
+        {
+        case tok_eof:
+            return;
+        case ';': // ignore top-level semicolons.
+            getNextToken();
+            break;
+        case tok_def:
+            HandleDefinition();
+            break;
+        case tok_extern:
+            HandleExtern();
+            break;
+        default:
+            HandleTopLevelExpression();
+            break;
+        }
+    }
+}
+
+// ---- Main driver code ---- //
+
+int main()
+{
+    AstArena = arena_create(GiB(4), MiB(1));
+    if (!AstArena)
+    {
+        fprintf(stderr, "Error: arena_create\n");
+        return 1;
+    }
+    Interactive = isatty(STDIN_FILENO);
+
+    // Install standard binary operators.
+    // 1 is lowest precedence.
+    BinopPrecedence['<'] = 10;
+    BinopPrecedence['+'] = 20;
+    BinopPrecedence['-'] = 20;
+    BinopPrecedence['*'] = 40; // highest.
+
+    auto Start = std::chrono::steady_clock::now();
+
+    // Prime the first token.
+    if (Interactive)
+        fprintf(stderr, "ready> ");
+    getNextToken();
+
+    // Run the main "interpreter loop" now.
+    MainLoop();
+
+    if (!Interactive)
+    {
+        std::chrono::duration<double, std::milli> Ms =
+            std::chrono::steady_clock::now() - Start;
+        fprintf(stderr,
+                "%ld definitions, %ld externs, %ld expressions, %ld errors"
+                " in %.1f ms\n",
+                Parsed.Definitions, Parsed.Externs, Parsed.Expressions,
+                Parsed.Errors, Ms.count());
+        fprintf(stderr, "AST: %.1f KiB in %llu chunks, %u identifiers\n",
+                AstArena->pos / 1024.0,
+                (unsigned long long)((AstArena->commit_pos +
+                                      AstArena->commit_size - 1) /
+                                     AstArena->commit_size),
+                Names.Count);
+    }
+    arena_destroy(AstArena);
+    free(Names.Slots);
+    return 0;
+}
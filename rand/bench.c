@@ -0,0 +1,239 @@
+// Throughput and quality checks for the generators in rand.c
+//
+//   ./bench                   ns/number and GB/s for every engine/distribution
+//   ./bench check             known answer and distribution sanity tests
+//   ./bench stream <engine>   raw 32 bit output to stdout, e.g.
+//                             ./bench stream xoshiro | RNG_test stdin32
+#define _DEFAULT_SOURCE
+#include "rand.c"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_COUNT (1u << 26)
+#define FILL_CHUNK 4096
+#define STREAM_CHUNK 16384
+
+typedef double f64;
+
+// keeps the compiler from dropping the generated numbers
+static volatile u32 s_sink;
+static volatile f32 s_sinkf;
+
+static f64 now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (f64)ts.tv_sec * 1e9 + (f64)ts.tv_nsec;
+}
+
+static void report(const char* engine, const char* dist, f64 ns, u64 count,
+                   u64 bytes_per_number) {
+  f64 per = ns / (f64)count;
+  f64 gbs = (f64)(count * bytes_per_number) / ns;
+  printf("%-14s %-10s %8.3f ns/number %8.3f GB/s\n", engine, dist, per, gbs);
+}
+
+// *** Benchmarks ***
+
+static void bench_pcg_legacy(void) {
+  prng_state rng;
+  prng_seed_r(&rng, 42u, 54u);
+
+  u32 acc = 0;
+  f64 start = now_ns();
+  for (u32 i = 0; i < BENCH_COUNT; i++) {
+    acc ^= prng_rand_r(&rng);
+  }
+  report("pcg32 (_r)", "u32", now_ns() - start, BENCH_COUNT, sizeof(u32));
+  s_sink = acc;
+}
+
+static void bench_engine(prng_kind kind) {
+  static u32 buf[FILL_CHUNK];
+  prng_gen gen;
+  prng_gen_init(&gen, kind, 42u, 54u);
+  const char* name = gen.engine->name;
+
+  u32 acc = 0;
+  f64 start = now_ns();
+  for (u32 i = 0; i < BENCH_COUNT; i++) {
+    acc ^= prng_gen_rand(&gen);
+  }
+  report(name, "u32", now_ns() - start, BENCH_COUNT, sizeof(u32));
+
+  start = now_ns();
+  for (u32 i = 0; i < BENCH_COUNT; i += FILL_CHUNK) {
+    prng_gen_fill(&gen, buf, FILL_CHUNK);
+    acc ^= buf[i & (FILL_CHUNK - 1)];
+  }
+  report(name, "u32 fill", now_ns() - start, BENCH_COUNT, sizeof(u32));
+
+  f32 accf = 0.0f;
+  start = now_ns();
+  for (u32 i = 0; i < BENCH_COUNT; i++) {
+    accf += prng_gen_randf(&gen);
+  }
+  report(name, "f32 [0-1)", now_ns() - start, BENCH_COUNT, sizeof(f32));
+
+  start = now_ns();
+  for (u32 i = 0; i < BENCH_COUNT / 4; i++) {
+    accf += prng_gen_norm(&gen);
+  }
+  report(name, "normal", now_ns() - start, BENCH_COUNT / 4, sizeof(f32));
+
+  s_sink = acc;
+  s_sinkf = accf;
+}
+
+// *** Quality checks ***
+
+static u32 s_failures = 0;
+
+static void expect(int ok, const char* what) {
+  printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+  if (!ok) {
+    s_failures++;
+  }
+}
+
+static void check_known_answers(void) {
+  // Random123 kat_vectors for philox4x32_10
+  u32 out[4];
+  const u32 zero_key[2] = {0, 0};
+  philox4x32_block(zero_key, 0, 0, out);
+  expect(out[0] == 0x6627e8d5u && out[1] == 0xe169c58du &&
+             out[2] == 0xbc57ac4cu && out[3] == 0x9b00dbd8u,
+         "philox4x32 zero vector");
+
+  const u32 pi_key[2] = {0xa4093822u, 0x299f31d0u};
+  philox4x32_block(pi_key, 0x85a308d3243f6a88ULL, 0x0370734413198a2eULL, out);
+  expect(out[0] == 0xd16cfe09u && out[1] == 0x94fdccebu &&
+             out[2] == 0x5001e420u && out[3] == 0x24126ea1u,
+         "philox4x32 pi vector");
+
+  // reference implementation output for state {1, 2, 3, 4}
+  xoshiro_state x = {{1, 2, 3, 4}};
+  expect(xoshiro_next64(&x) == 11520u, "xoshiro256** reference output");
+
+  // sequential, bulk and indexed access must agree
+  prng_gen seq, bulk;
+  prng_gen_init(&seq, PRNG_PHILOX4X32, 7u, 11u);
+  prng_gen_init(&bulk, PRNG_PHILOX4X32, 7u, 11u);
+  u32 buf[37];
+  prng_gen_rand(&bulk);
+  prng_gen_fill(&bulk, buf, 37);
+  int same = prng_gen_rand(&seq) == philox_at(&seq.state.philox, 0);
+  for (u32 i = 0; i < 37; i++) {
+    same &= buf[i] == prng_gen_rand(&seq);
+    same &= buf[i] == philox_at(&seq.state.philox, i + 1);
+  }
+  expect(same, "philox4x32 sequential, fill and indexed agree");
+}
+
+static void check_distributions(prng_kind kind) {
+  const u64 n = 1u << 22;
+  prng_gen gen;
+  prng_gen_init(&gen, kind, 1234u, 5678u);
+
+  // every bit should be set half the time
+  u64 ones[32] = {0};
+  for (u64 i = 0; i < n; i++) {
+    u32 r = prng_gen_rand(&gen);
+    for (u32 b = 0; b < 32; b++) {
+      ones[b] += (r >> b) & 1u;
+    }
+  }
+  f64 worst = 0.0;
+  for (u32 b = 0; b < 32; b++) {
+    f64 z = ((f64)ones[b] - n / 2.0) / sqrt(n / 4.0);
+    worst = fabs(z) > worst ? fabs(z) : worst;
+  }
+
+  // mean 1/2 variance 1/12 for uniform, mean 0 variance 1 for normal
+  f64 sum = 0.0, sq = 0.0, nsum = 0.0, nsq = 0.0;
+  for (u64 i = 0; i < n; i++) {
+    f64 u = prng_gen_randf(&gen);
+    f64 z = prng_gen_norm(&gen);
+    sum += u;
+    sq += u * u;
+    nsum += z;
+    nsq += z * z;
+  }
+  f64 mean = sum / n, var = sq / n - mean * mean;
+  f64 nmean = nsum / n, nvar = nsq / n - nmean * nmean;
+
+  char what[128];
+  snprintf(what, sizeof(what), "%s bit frequency (worst |z| %.2f)",
+           gen.engine->name, worst);
+  expect(worst < 6.0, what);
+  snprintf(what, sizeof(what), "%s uniform mean %.4f var %.4f",
+           gen.engine->name, mean, var);
+  expect(fabs(mean - 0.5) < 0.002 && fabs(var - 1.0 / 12.0) < 0.002, what);
+  snprintf(what, sizeof(what), "%s normal mean %.4f var %.4f",
+           gen.engine->name, nmean, nvar);
+  expect(fabs(nmean) < 0.005 && fabs(nvar - 1.0) < 0.01, what);
+}
+
+// *** Raw output ***
+
+static int find_engine(const char* name, prng_kind* kind) {
+  for (u32 k = 0; k < PRNG_COUNT; k++) {
+    // prefix match so "xoshiro" selects "xoshiro256**"
+    const char* full = prng_engine_get(k)->name;
+    if (strncmp(full, name, strlen(name)) == 0) {
+      *kind = k;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int stream(const char* name) {
+  prng_kind kind;
+  if (!find_engine(name, &kind)) {
+    fprintf(stderr, "unknown engine '%s'\n", name);
+    return 1;
+  }
+
+  u64 seed[2] = {0};
+  getentropy(seed, sizeof(seed));
+  prng_gen gen;
+  prng_gen_init(&gen, kind, seed[0], seed[1]);
+
+  static u32 buf[STREAM_CHUNK];
+  for (;;) {
+    prng_gen_fill(&gen, buf, STREAM_CHUNK);
+    if (fwrite(buf, sizeof(u32), STREAM_CHUNK, stdout) != STREAM_CHUNK) {
+      // reader closed the pipe
+      return 0;
+    }
+  }
+}
+
+int main(int argc, char* argv[]) {
+  if (argc >= 3 && strcmp(argv[1], "stream") == 0) {
+    return stream(argv[2]);
+  }
+
+  if (argc >= 2 && strcmp(argv[1], "check") == 0) {
+    check_known_answers();
+    for (u32 k = 0; k < PRNG_COUNT; k++) {
+      check_distributions(k);
+    }
+    printf("%u failure(s)\n", s_failures);
+    return s_failures ? 1 : 0;
+  }
+
+  if (argc >= 2) {
+    fprintf(stderr, "usage: %s [check | stream <engine>]\n", argv[0]);
+    return 1;
+  }
+
+  bench_pcg_legacy();
+  for (u32 k = 0; k < PRNG_COUNT; k++) {
+    bench_engine(k);
+  }
+  return 0;
+}
@@ -2,7 +2,7 @@
 #include <stdio.h>
 #include <unistd.h>
 
-int main(int argc, char* argv[]) {
+int main(void) {
 
   u64 state[2] = {0};
   prng_state rng = {};
@@ -13,5 +13,19 @@ int main(int argc, char* argv[]) {
   for (u32 i = 0; i < 10; i++) {
     printf("%d: %f\n", i, prng_rand_norm_r(&rng));
   }
+
+  // Same seed through every engine of the family
+  for (u32 kind = 0; kind < PRNG_COUNT; kind++) {
+    prng_gen gen;
+    prng_gen_init(&gen, kind, state[0], state[1]);
+    printf("%s: %u %f %f\n", gen.engine->name, prng_gen_rand(&gen),
+           prng_gen_randf(&gen), prng_gen_norm(&gen));
+  }
+
+  // Philox is counter based, any index can be computed on its own
+  prng_gen philox;
+  prng_gen_init(&philox, PRNG_PHILOX4X32, state[0], state[1]);
+  printf("philox4x32[1000000]: %u\n",
+         philox_at(&philox.state.philox, 1000000));
   return 0;
 }
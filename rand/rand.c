@@ -3,6 +3,7 @@
 // this time generate random numbers
 // Unlike RNG this are harder to predict
 #include <math.h>
+#include <stddef.h>
 #include <stdint.h>
 
 typedef uint32_t u32;
@@ -49,6 +50,74 @@ f32 prng_randf(void);
 f32 prng_rand_norm_r(prng_state* rng);
 f32 prng_rand_norm(void);
 
+// *** Generator family prototypes ***
+
+// Engines that can be plugged behind the common prng_gen interface
+typedef enum {
+  PRNG_PCG32,
+  PRNG_XOSHIRO256SS,
+  PRNG_PHILOX4X32,
+  PRNG_COUNT
+} prng_kind;
+
+// xoshiro256** (https://prng.di.unimi.it), 256 bits of state
+typedef struct {
+  u64 s[4];
+} xoshiro_state;
+
+// Philox4x32-10 (Salmon et al. "Parallel random numbers: as easy as 1, 2, 3")
+// The output is a pure function of (key, counter) so the n-th number of a
+// stream can be computed directly, the counter is only kept for sequential use
+typedef struct {
+  u32 key[2];
+  u64 stream;  // upper 64 bits of the 128 bit counter
+  u64 ctr;     // index of the next 4 word block
+  u32 block[4];
+  u32 idx;     // next word to hand out from block (4 = exhausted)
+} philox_state;
+
+// Vtable every engine provides, state is the matching member of prng_gen
+typedef struct {
+  const char* name;
+  void (*seed)(void* state, u64 initstate, u64 initseq);
+  u32 (*next)(void* state);
+} prng_engine;
+
+// Generic generator, distributions are built on top of engine->next
+typedef struct {
+  const prng_engine* engine;
+  union {
+    prng_state pcg;
+    xoshiro_state xoshiro;
+    philox_state philox;
+  } state;
+
+  f32 prev_norm;
+} prng_gen;
+
+// xoshiro256**
+void xoshiro_seed(xoshiro_state* rng, u64 initstate, u64 initseq);
+u64 xoshiro_next64(xoshiro_state* rng);
+u32 xoshiro_next(xoshiro_state* rng);
+// Advances 2^128 steps, gives non overlapping sequences to parallel workers
+void xoshiro_jump(xoshiro_state* rng);
+
+// Philox4x32-10
+void philox_seed(philox_state* rng, u64 initstate, u64 initseq);
+void philox4x32_block(const u32 key[2], u64 ctr, u64 stream, u32 out[4]);
+u32 philox_next(philox_state* rng);
+// Stateless access to the n-th 32 bit number of the stream
+u32 philox_at(const philox_state* rng, u64 n);
+
+// Common interface
+const prng_engine* prng_engine_get(prng_kind kind);
+// 0 for an unknown kind, gen is left without an engine then
+int prng_gen_init(prng_gen* gen, prng_kind kind, u64 initstate, u64 initseq);
+u32 prng_gen_rand(prng_gen* gen);
+f32 prng_gen_randf(prng_gen* gen);
+f32 prng_gen_norm(prng_gen* gen);
+void prng_gen_fill(prng_gen* gen, u32* out, u64 count);
+
 // global hidden state for non reentrant functions
 static __thread prng_state s_prng_state = {0x853c49e6748fea9bULL,
                                            0xda3e39cb94b95bdbULL, NAN};
@@ -125,3 +194,231 @@ f32 prng_rand_norm_r(prng_state* rng) {
 f32 prng_rand_norm(void) {
   return prng_rand_norm_r(&s_prng_state);
 }
+
+// *** SplitMix64 ***
+
+// Used to expand 128 bits of seed into the 256 bits xoshiro needs, it never
+// returns the all zero state that would lock xoshiro at zero
+static u64 splitmix64(u64* x) {
+  u64 z = (*x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// *** xoshiro256** ***
+
+static inline u64 rotl64(u64 x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+void xoshiro_seed(xoshiro_state* rng, u64 initstate, u64 initseq) {
+  u64 x = initstate ^ rotl64(initseq, 32);
+  for (u32 i = 0; i < 4; i++) {
+    rng->s[i] = splitmix64(&x);
+  }
+}
+
+u64 xoshiro_next64(xoshiro_state* rng) {
+  u64* s = rng->s;
+  u64 result = rotl64(s[1] * 5, 7) * 9;
+  u64 t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+
+  s[2] ^= t;
+  s[3] = rotl64(s[3], 45);
+
+  return result;
+}
+
+// upper bits are the strongest ones
+u32 xoshiro_next(xoshiro_state* rng) {
+  return (u32)(xoshiro_next64(rng) >> 32);
+}
+
+void xoshiro_jump(xoshiro_state* rng) {
+  static const u64 jump[] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+                             0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+  u64 s[4] = {0};
+  for (u32 i = 0; i < 4; i++) {
+    for (u32 b = 0; b < 64; b++) {
+      if (jump[i] & (1ULL << b)) {
+        s[0] ^= rng->s[0];
+        s[1] ^= rng->s[1];
+        s[2] ^= rng->s[2];
+        s[3] ^= rng->s[3];
+      }
+      xoshiro_next64(rng);
+    }
+  }
+  for (u32 i = 0; i < 4; i++) {
+    rng->s[i] = s[i];
+  }
+}
+
+// *** Philox4x32-10 ***
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u  // golden ratio
+#define PHILOX_W1 0xBB67AE85u  // sqrt(3) - 1
+
+void philox_seed(philox_state* rng, u64 initstate, u64 initseq) {
+  rng->key[0] = (u32)initstate;
+  rng->key[1] = (u32)(initstate >> 32);
+  rng->stream = initseq;
+  rng->ctr = 0;
+  rng->idx = 4;
+}
+
+// 10 rounds of multiply/xor over the 128 bit counter {ctr, stream}
+void philox4x32_block(const u32 key[2], u64 ctr, u64 stream, u32 out[4]) {
+  u32 c0 = (u32)ctr, c1 = (u32)(ctr >> 32);
+  u32 c2 = (u32)stream, c3 = (u32)(stream >> 32);
+  u32 k0 = key[0], k1 = key[1];
+
+  for (u32 round = 0; round < 10; round++) {
+    u64 p0 = (u64)PHILOX_M0 * c0;
+    u64 p1 = (u64)PHILOX_M1 * c2;
+    u32 n0 = (u32)(p1 >> 32) ^ c1 ^ k0;
+    u32 n2 = (u32)(p0 >> 32) ^ c3 ^ k1;
+    c1 = (u32)p1;
+    c3 = (u32)p0;
+    c0 = n0;
+    c2 = n2;
+
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+
+  out[0] = c0;
+  out[1] = c1;
+  out[2] = c2;
+  out[3] = c3;
+}
+
+u32 philox_next(philox_state* rng) {
+  if (rng->idx == 4) {
+    philox4x32_block(rng->key, rng->ctr++, rng->stream, rng->block);
+    rng->idx = 0;
+  }
+  return rng->block[rng->idx++];
+}
+
+// Doesnt touch the sequential position so any thread can call it on a shared
+// state
+u32 philox_at(const philox_state* rng, u64 n) {
+  u32 out[4];
+  philox4x32_block(rng->key, n >> 2, rng->stream, out);
+  return out[n & 3];
+}
+
+// *** Common generator interface ***
+
+static void pcg_engine_seed(void* state, u64 initstate, u64 initseq) {
+  prng_seed_r(state, initstate, initseq);
+}
+static u32 pcg_engine_next(void* state) {
+  return prng_rand_r(state);
+}
+static void xoshiro_engine_seed(void* state, u64 initstate, u64 initseq) {
+  xoshiro_seed(state, initstate, initseq);
+}
+static u32 xoshiro_engine_next(void* state) {
+  return xoshiro_next(state);
+}
+static void philox_engine_seed(void* state, u64 initstate, u64 initseq) {
+  philox_seed(state, initstate, initseq);
+}
+static u32 philox_engine_next(void* state) {
+  return philox_next(state);
+}
+
+static const prng_engine s_prng_engines[PRNG_COUNT] = {
+    [PRNG_PCG32] = {"pcg32", pcg_engine_seed, pcg_engine_next},
+    [PRNG_XOSHIRO256SS] = {"xoshiro256**", xoshiro_engine_seed,
+                           xoshiro_engine_next},
+    [PRNG_PHILOX4X32] = {"philox4x32", philox_engine_seed, philox_engine_next},
+};
+
+const prng_engine* prng_engine_get(prng_kind kind) {
+  if (kind >= PRNG_COUNT) {
+    return NULL;
+  }
+  return &s_prng_engines[kind];
+}
+
+int prng_gen_init(prng_gen* gen, prng_kind kind, u64 initstate, u64 initseq) {
+  gen->engine = prng_engine_get(kind);
+  gen->prev_norm = NAN;
+  if (gen->engine == NULL) {
+    return 0;
+  }
+  gen->engine->seed(&gen->state, initstate, initseq);
+  return 1;
+}
+
+u32 prng_gen_rand(prng_gen* gen) {
+  return gen->engine->next(&gen->state);
+}
+
+// [0-1) with the 24 bits a float can hold, so 1.0 is never returned
+f32 prng_gen_randf(prng_gen* gen) {
+  return (f32)(prng_gen_rand(gen) >> 8) * (1.0f / 16777216.0f);
+}
+
+// Same Box-Muller pairing as prng_rand_norm_r
+f32 prng_gen_norm(prng_gen* gen) {
+  if (!isnan(gen->prev_norm)) {
+    f32 out = gen->prev_norm;
+    gen->prev_norm = NAN;
+    return out;
+  }
+
+  f32 u1 = 0.0f;
+  do {
+    u1 = prng_gen_randf(gen);
+  } while (u1 == 0.0f);
+  f32 u2 = prng_gen_randf(gen);
+
+  f32 mag = sqrtf(-2.0f * logf(u1));
+  f32 z0 = mag * cosf(2.0f * (f32)PI * u2);
+  f32 z1 = mag * sinf(2.0f * (f32)PI * u2);
+
+  gen->prev_norm = z1;
+  return z0;
+}
+
+// Bulk generation, switches on the engine once instead of an indirect call per
+// number so the compiler can keep the state in registers
+void prng_gen_fill(prng_gen* gen, u32* out, u64 count) {
+  u64 i = 0;
+  if (gen->engine == &s_prng_engines[PRNG_XOSHIRO256SS]) {
+    xoshiro_state s = gen->state.xoshiro;
+    for (; i < count; i++) {
+      out[i] = xoshiro_next(&s);
+    }
+    gen->state.xoshiro = s;
+  } else if (gen->engine == &s_prng_engines[PRNG_PHILOX4X32]) {
+    philox_state* s = &gen->state.philox;
+    // drain a partially used block first so the sequence matches philox_next
+    while (i < count && s->idx < 4) {
+      out[i++] = s->block[s->idx++];
+    }
+    // blocks are independent of each other, no loop carried dependency
+    for (; i + 4 <= count; i += 4) {
+      philox4x32_block(s->key, s->ctr++, s->stream, &out[i]);
+    }
+    for (; i < count; i++) {
+      out[i] = philox_next(s);
+    }
+  } else {
+    for (; i < count; i++) {
+      out[i] = prng_gen_rand(gen);
+    }
+  }
+}
@@ -4,16 +4,30 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "../allocator/arena.h"
+
 /*** defines ***/
 
 #define NOTSY_VERSION "0.0.1"
@@ -37,32 +51,182 @@ enum editorKey {
     HOME_KEY,
     END_KEY,
     PAGE_UP,
-    PAGE_DOWN
+    PAGE_DOWN,
+    TICK_KEY // no key came in time, see editorReadKeyTimeout
+};
+
+// Attribute of a screen cell, editorScreenAttr() has the escape sequence
+enum screenAttr {
+    ATTR_NORMAL = 0,
+    ATTR_INVERSE,
+    ATTR_COMMENT,
+    ATTR_KEYWORD1,
+    ATTR_KEYWORD2,
+    ATTR_STRING,
+    ATTR_NUMBER
 };
 
+// Tokenizer state carried from the end of a row to the next one
+enum syntaxState { HLS_NORMAL = 0, HLS_COMMENT, HLS_UNKNOWN = 255 };
+
+#define HL_HIGHLIGHT_NUMBERS (1 << 0)
+#define HL_HIGHLIGHT_STRINGS (1 << 1)
+
 /*** data ***/
 
 // Row (line) of text in the editor
 typedef struct erow {
     int size;     // length of chars excluding null terminator
+    int cap;      // allocated bytes of chars, grows geometrically. 0 when
+                  // chars points into the file mapping (not NUL terminated)
     int rsize;    // length of rendered text (render)
+    int rcap;     // allocated bytes of render, room for every tab at full width
     char* chars;  // pointer to the raw text of the line (file content)
     char* render; // pointer to the rendered version of line (tabs expanded)
-
+    int* tabs;    // built with render, NULL without tabs. tabs[0] tabs, then
+                  // per tab its index in chars and the rx right after it
+    unsigned char* hl;      // enum screenAttr of every render char, built
+                            // with render when the row is drawn
+    unsigned char hl_in;    // state hl was built from
+    unsigned char hl_state; // enum syntaxState at the end of the row
 } erow;
 
-// Global state of the editor - E
-struct editorConfig {
+// Highlighting rules of a filetype
+struct editorSyntax {
+    char* filetype;
+    char** filematch;  // extensions (starting with .) or names
+    char** keywords;   // a trailing | marks a type keyword
+    char* singleline_comment_start;
+    char* multiline_comment_start;
+    char* multiline_comment_end;
+    int flags;         // HL_HIGHLIGHT_*
+};
+
+// Gap buffer of rows, the free slots sit where the last row was inserted or
+// deleted so pressing enter only moves the rows between the old and the new
+// position instead of the whole file
+typedef struct rowbuf {
+    erow* rows;    // cap slots, rows before and after the gap
+    int cap;       // allocated slots
+    int gap_start; // first free slot
+    int gap_end;   // first used slot after the gap
+} rowbuf;
+
+// Contents of the terminal, one char and attribute per cell. Frames are
+// drawn into one and compared against the other, which holds what the
+// terminal is currently showing
+typedef struct screen {
+    int rows;             // lines, text area plus status and message bar
+    int cols;             // cells per line
+    char* chars;          // rows * cols characters
+    unsigned char* attrs; // rows * cols enum screenAttr
+    int* lens;            // used cells on each line, the rest is blank
+} screen;
+
+// Lines of a large file replaced by edited rows, see largeFold()
+typedef struct largeOverlay {
+    u64 off;    // first byte of the replaced lines in the file
+    u64 len;    // bytes of the replaced lines, 0 for rows inserted at off
+    int flines; // lines in [off, off + len)
+    int nrows;  // rows replacing them
+    erow* rows; // every one owns its chars
+} largeOverlay;
+
+// Views side by side at most
+#define EDITOR_MAX_VIEWS 8
+
+// A window of a large file that is not the one in the buffer rows. It is
+// kept for a view far from the cursor of the current one, see largeSwapTo()
+typedef struct largeWindow {
+    rowbuf rows;
+    u64 lo, hi;
+    int first;
+    int count;
+    int at_eof;
+} largeWindow;
+
+// A large file is never indexed as a whole. Its rows only hold a window,
+// rows [first, first + count) of the buffer, read from [lo, hi) of the file
+// with the overlays in that range applied. A line counter works through the
+// file in the background meanwhile
+struct largeFile {
+    int active;           // the buffer is windowed
+    u64 lo, hi;           // file range of the window
+    int first;            // buffer row of the first window row
+    int count;            // rows in the window
+    int edited;           // window rows differ from the file and overlays
+    int at_eof;           // the window reaches the end of the file
+    int crlf;             // the first line ends in \r\n, edited rows too
+    // Windows other views are in, folded and never overlapping the one in
+    // the buffer rows or each other
+    largeWindow park[EDITOR_MAX_VIEWS];
+    int npark;
+    rowbuf spare[EDITOR_MAX_VIEWS]; // row arrays of dropped windows
+    int nspare;
+    int delta;            // rows inserted minus rows deleted
+    long long file_lines; // lines in the file, an estimate until exact
+    int exact;            // file_lines is known
+    largeOverlay* ov;     // sorted by off, at most one per offset
+    int nov;
+    int cap_ov;
+    // Line counter, the fields after fd are written by its thread
+    pthread_t thread;
+    int fd;
+    int stop;
+    u64* marks;          // start of every LARGE_MARK_LINES-th line
+    long long nmarks;    // marks published so far
+    u64 count_bytes;     // bytes counted so far
+    long long count_lines; // newlines in them
+    int count_done;
+};
+
+// A file in memory, its rows and everything built from them. Views of the
+// same file share one, so it is only loaded once
+struct editorBuffer {
+    int numrows;           // row of the file
+    rowbuf rows;           // lines of the file, use editorRow() to index
+    int dirty;             // curren buffer has changed
+    char* filename;        // name of the opened file
+    char* map;             // read only mapping of the opened file
+    size_t maplen;         // length of map
+    mem_arena* arena;      // chars, render and row slots of the buffer
+    char* pool[32];        // freed arena blocks, one list per power of two
+    struct editorSyntax* syntax; // NULL for plain text
+    int hl_valid;          // rows before it have an up to date hl_state
+    int hl_known;          // rows before it had their hl_state computed
+    int hl_dirty;          // rows at or after it were not edited since
+    mem_arena* undo;       // undo journal, see undoOp
+    u32 undo_top;          // offset of the last record applied, 0 for none
+    struct largeFile large; // windowed mode, see largeOpen()
+};
+
+// A buffer shown in a column of the text area
+struct editorView {
+    struct editorBuffer* buf;
     int cx, cy;            // cursor position
     int rx;                // rendered coordinate
     int rowoff;            // offset
     int coloff;            // offset
-    int screenrows;        // number of rows in the terminal
+    int left;              // first screen column
+    int cols;              // screen columns
+    int render_lo;         // rows of buf in [render_lo, render_hi) may have
+    int render_hi;         // a render cached for this view
+};
+
+// Global state of the editor - E
+struct editorConfig {
+    struct editorView* view;   // view with the cursor
+    struct editorBuffer* buf;  // its buffer, the one edits go to
+    struct editorView views[EDITOR_MAX_VIEWS]; // left to right
+    int nviews;
+    struct editorBuffer** bufs; // every opened buffer
+    int nbufs;
+    int screenrows;        // rows of the text area
     int screencols;        // number of columns on the terminal
-    int numrows;           // row of the file
-    erow* row;             // array of erow 0 - lines of file
-    int dirty;             // curren buffer has changed
-    char* filename;        // name of the opened file
+    screen front;          // what the terminal shows
+    screen back;           // frame being drawn
+    int front_valid;       // 0 until the terminal has been cleared once
+    int front_rowoff;      // rowoff of the frame in front
     char statusmsg[80];    // buffer for status message
     time_t statusmsg_time; // timestamp to when the statumsg was set
     struct termios
@@ -71,40 +235,76 @@ struct editorConfig {
 
 struct editorConfig E;
 
+// Large file state of E.buf, set together with it
+struct largeFile* L;
+
+// Files from this size on open windowed, --large forces it for any size
+#define LARGE_FILE_MIN GiB(1)
+// Smaller files with more lines open windowed too, an erow per line would
+// take more than the file (48 bytes each, 192 MiB at this count)
+#define LARGE_INDEX_ROWS (1 << 22)
+// Rows loaded around the cursor
+#define LARGE_WINDOW_ROWS 65536
+// Rows kept loaded on both sides of the cursor before the window slides
+#define LARGE_MARGIN 1024
+// The line counter remembers where every this many lines start, so a jump
+// far away only walks part of the file
+#define LARGE_MARK_LINES 65536
+// Bytes the line counter reads at once
+#define LARGE_COUNT_CHUNK MiB(1)
+
+int large_forced = 0;
+
 /*** prototypes ***/
 
 void editorSetStatusMessage(const char* fmt, ...);
 void editorRefreshScreen();
 char* editorPrompt(char* prompt, void (*callback)(char*, int));
+void editorRowsKeepRenders(int lo, int hi);
+void editorRowsDropRenders();
+void largeWindowAt(int at);
+int largeSwapTo(int at, int past);
+void largeShiftParked(int dir);
+void largeOpen(int fd);
+void largeClose();
+long long largeWriteRows(int fd);
 
 /*** utilitiees ***/
 
-// Returns an array of indexes of needles (matches) found on a haystack (string)
-int* row_substr(char* haystack, char* needle) {
-
-    int capacity = 64;
-    int count_m = 0;
-    int* matches = malloc(sizeof(int) * capacity);
-    char* match;
-    char* current_pos = haystack;
-
-    while ((match = strstr(current_pos, needle))) {
-        if (count_m >= capacity) {
-            capacity *= 2;
-            int* temp = realloc(matches, sizeof(int) * capacity);
-            if (!temp) {
-                free(matches);
-                return NULL;
-            }
-            matches = temp;
-        }
+/*** trace ***/
+
+// --trace writes a line per key handled by the main loop and per frame:
+//   k <key> <us in editorProcessKeypress>
+//   f <keys read since the last frame> <us in editorRefreshScreen> <bytes>
+// --record copies everything read from the terminal to a file, which
+// --bench-replay can play back
+struct traceState {
+    FILE* out;  // --trace file, NULL when off
+    int record; // --record file, -1 when off
+    int keys;   // keys read since the last frame
+};
 
-        matches[count_m++] = match - haystack;
-        current_pos = match + strlen(needle);
-    }
+struct traceState T = {NULL, -1, 0};
+
+double benchNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-    matches[count_m] = -1;
-    return matches;
+// Start of a traced call, the clock is only read with --trace
+double traceStart() { return T.out ? benchNow() : 0; }
+
+void traceKey(int key, double start) {
+    if (T.out)
+        fprintf(T.out, "k %d %.1f\n", key, (benchNow() - start) * 1e6);
+}
+
+void traceFrame(double start, int bytes) {
+    if (T.out)
+        fprintf(T.out, "f %d %.1f %d\n", T.keys, (benchNow() - start) * 1e6,
+                bytes);
+    T.keys = 0;
 }
 
 /*** terminal ***/
@@ -187,78 +387,168 @@ void enableRawMode() {
 }
 
 // Waits fo keypress and return it and hanldes escape sequences
-int editorReadKey() {
-    int nread;
-    char c;
-    // Read from standard input, into c, one byte
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-        // if reading fails and the error is not EAGAIN macro, exit with fail on
-        // the read process EAGAIN - currently unaviable might succeed if
-        // attempted again later
-        if (nread == -1 && errno != EAGAIN)
-            die("read");
+// Bytes read from the terminal that are not keys yet, filled a chunk at a
+// time so a paste takes one read() instead of one per byte
+#define INPUT_BUF_SIZE 4096
+// How long the rest of an escape sequence may take before it is a lone ESC
+#define KEY_ESC_TIMEOUT 100
+
+struct inputBuf {
+    char buf[INPUT_BUF_SIZE];
+    int start; // first byte not parsed yet
+    int len;   // bytes from start
+};
+
+struct inputBuf IN;
+
+// Waits up to timeout ms (-1 forever) for input and appends what is there,
+// returns the number of bytes read
+int editorFillInput(int timeout) {
+    if (IN.start > 0) {
+        memmove(IN.buf, &IN.buf[IN.start], IN.len);
+        IN.start = 0;
+    }
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    int ready = poll(&pfd, 1, timeout);
+    if (ready == -1 && errno != EINTR)
+        die("poll");
+    if (ready <= 0)
+        return 0;
+
+    ssize_t nread = read(STDIN_FILENO, &IN.buf[IN.len], INPUT_BUF_SIZE - IN.len);
+    // if reading fails and the error is not EAGAIN macro, exit with fail on
+    // the read process EAGAIN - currently unaviable might succeed if
+    // attempted again later
+    if (nread == -1 && errno != EAGAIN && errno != EINTR)
+        die("read");
+    if (nread <= 0)
+        return 0;
+    if (T.record != -1)
+        write(T.record, &IN.buf[IN.len], nread);
+    IN.len += nread;
+    return nread;
+}
+
+// Parses the key at the start of s and stores it in key. Returns the bytes
+// it took, 0 when s is empty and minus the length of an escape sequence that
+// is not complete yet
+int editorParseKey(const char* s, int len, int* key) {
+    if (len == 0)
+        return 0;
+    if (s[0] != '\x1b') {
+        *key = s[0];
+        return 1;
     }
 
-    if (c == '\x1b') {
-        char seq[3];
-        if (read(STDIN_FILENO, &seq[0], 1) != 1)
-            return '\x1b';
-        if (read(STDIN_FILENO, &seq[1], 1) != 1)
-            return '\x1b';
-
-        if (seq[0] == '[') {
-            if (seq[1] >= '0' && seq[1] <= '9') {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1)
-                    return '\x1b';
-                if (seq[2] == '~') {
-                    switch (seq[1]) {
-                    case '1':
-                        return HOME_KEY;
-                    case '3':
-                        return DEL_KEY;
-                    case '4':
-                        return END_KEY;
-                    case '5':
-                        return PAGE_UP;
-                    case '6':
-                        return PAGE_DOWN;
-                    case '7':
-                        return HOME_KEY;
-                    case '8':
-                        return END_KEY;
-                    }
-                }
-            } else {
-                switch (seq[1]) {
-                case 'A':
-                    return ARROW_UP;
-                case 'B':
-                    return ARROW_DOWN;
-                case 'C':
-                    return ARROW_RIGHT;
-                case 'D':
-                    return ARROW_LEFT;
-                case 'H':
-                    return HOME_KEY;
-                case 'F':
-                    return END_KEY;
+    *key = '\x1b'; // escape character unless the sequence is known
+    if (len < 3)
+        return -len;
+
+    if (s[1] == '[') {
+        if (s[2] >= '0' && s[2] <= '9') {
+            if (len < 4)
+                return -len;
+            if (s[3] == '~') {
+                switch (s[2]) {
+                case '1':
+                    *key = HOME_KEY;
+                    break;
+                case '3':
+                    *key = DEL_KEY;
+                    break;
+                case '4':
+                    *key = END_KEY;
+                    break;
+                case '5':
+                    *key = PAGE_UP;
+                    break;
+                case '6':
+                    *key = PAGE_DOWN;
+                    break;
+                case '7':
+                    *key = HOME_KEY;
+                    break;
+                case '8':
+                    *key = END_KEY;
+                    break;
                 }
             }
-        } else if (seq[0] == 'O') {
-            switch (seq[1]) {
-            case 'H':
-                return HOME_KEY;
-            case 'F':
-                return END_KEY;
-            }
+            return 4;
+        }
+        switch (s[2]) {
+        case 'A':
+            *key = ARROW_UP;
+            break;
+        case 'B':
+            *key = ARROW_DOWN;
+            break;
+        case 'C':
+            *key = ARROW_RIGHT;
+            break;
+        case 'D':
+            *key = ARROW_LEFT;
+            break;
+        case 'H':
+            *key = HOME_KEY;
+            break;
+        case 'F':
+            *key = END_KEY;
+            break;
         }
+    } else if (s[1] == 'O') {
+        switch (s[2]) {
+        case 'H':
+            *key = HOME_KEY;
+            break;
+        case 'F':
+            *key = END_KEY;
+            break;
+        }
+    }
+    return 3;
+}
 
-        return '\x1b'; // we return escape character
-    } else {
-        return c;
+// Returns the next key, or TICK_KEY if none comes in timeout ms. -1 waits
+// forever, 0 only takes keys that already arrived
+int editorReadKeyTimeout(int timeout) {
+    while (1) {
+        int key;
+        int n = editorParseKey(&IN.buf[IN.start], IN.len, &key);
+        if (n > 0) {
+            IN.start += n;
+            IN.len -= n;
+            T.keys++;
+            return key;
+        }
+        // The rest of a sequence is normally right behind its ESC
+        if (editorFillInput(n < 0 ? KEY_ESC_TIMEOUT : timeout) > 0)
+            continue;
+        if (n < 0) {
+            IN.start += -n;
+            IN.len -= -n;
+            T.keys++;
+            return key;
+        }
+        if (timeout >= 0)
+            return TICK_KEY;
     }
 }
 
+int editorReadKey() { return editorReadKeyTimeout(-1); }
+
+// Milliseconds until the screen has to be drawn again without a key, -1
+// when nothing is scheduled
+int editorNextTimer() {
+    // The line count of a large file is still coming in
+    int count = L->active && !L->exact ? 250 : -1;
+    if (E.statusmsg[0] == '\0')
+        return count;
+    time_t left = E.statusmsg_time + 5 - time(NULL);
+    if (left <= 0)
+        return count;
+    return count != -1 && count < left * 1000 ? count : left * 1000;
+}
+
 int getCursorPosition(int* rows, int* cols) {
     char buf[32];
     unsigned int i = 0;
@@ -314,436 +604,3253 @@ int getWindowSize(int* rows, int* cols) {
     }
 }
 
-/*** row operations ***/
+/*** row storage ***/
+
+// Returns row at, valid until the next row insertion or deletion
+erow* editorRow(int at) {
+    if (L->active) {
+        if ((at < L->first || at >= L->first + L->count) &&
+            !largeSwapTo(at, 0))
+            largeWindowAt(at);
+        at -= L->first;
+    }
+    if (at >= E.buf->rows.gap_start)
+        at += E.buf->rows.gap_end - E.buf->rows.gap_start;
+    return &E.buf->rows.rows[at];
+}
+
+// Index of a row returned by editorRow()
+int editorRowIndex(erow* row) {
+    int at = row - E.buf->rows.rows;
+    if (at >= E.buf->rows.gap_end)
+        at -= E.buf->rows.gap_end - E.buf->rows.gap_start;
+    return at + (L->active ? L->first : 0);
+}
+
+// Slides the gap so it starts at row at, only the rows in between move
+void editorRowsMoveGap(int at) {
+    rowbuf* rb = &E.buf->rows;
+    int gap = rb->gap_end - rb->gap_start;
+
+    if (at < rb->gap_start) {
+        memmove(&rb->rows[at + gap], &rb->rows[at],
+                sizeof(erow) * (rb->gap_start - at));
+    } else if (at > rb->gap_start) {
+        memmove(&rb->rows[rb->gap_start], &rb->rows[rb->gap_end],
+                sizeof(erow) * (at - rb->gap_start));
+    }
+    rb->gap_start = at;
+    rb->gap_end = at + gap;
+}
+
+// Doubles the slots when the gap is used up, the rows after the gap move to
+// the end of the new array. The old one stays in the arena until the buffer
+// is closed, at most as much as the current array
+void editorRowsGrow() {
+    rowbuf* rb = &E.buf->rows;
+    int cap = rb->cap ? rb->cap * 2 : 64;
+    int tail = rb->cap - rb->gap_end;
+
+    erow* rows = PUSH_ARRAY_NZ(E.buf->arena, erow, cap);
+    if (rows == NULL)
+        die("arena_push");
+    if (rb->rows) {
+        memcpy(rows, rb->rows, sizeof(erow) * rb->gap_start);
+        memcpy(&rows[cap - tail], &rb->rows[rb->gap_end], sizeof(erow) * tail);
+    }
+    rb->rows = rows;
+    rb->gap_end = cap - tail;
+    rb->cap = cap;
+}
+
+// Row text is carved out of the buffer arena in power of two blocks. Freed
+// blocks go to its pool by size and are handed out again before the arena
+// grows, so the arena is only given back as a whole in editorCloseBuffer()
+int editorPoolClass(int size) {
+    return size <= 16 ? 4 : 32 - __builtin_clz(size - 1);
+}
+
+// Largest block, its size still fits cap
+#define EDITOR_POOL_MAX (1 << 30)
+
+// Returns a block of at least size bytes, its real size is stored in cap
+char* editorPoolAlloc(int size, int* cap) {
+    if (size > EDITOR_POOL_MAX)
+        die("editorPoolAlloc");
+    int c = editorPoolClass(size);
+    char* p = E.buf->pool[c];
+    if (p) {
+        memcpy(&E.buf->pool[c], p, sizeof(char*));
+    } else {
+        p = arena_push(E.buf->arena, (u64)1 << c, true);
+        if (p == NULL)
+            die("arena_push");
+    }
+    if (cap)
+        *cap = 1 << c;
+    return p;
+}
+
+// size has to be the one the block was asked for (or its cap)
+void editorPoolFree(char* p, int size) {
+    if (p == NULL)
+        return;
+    int c = editorPoolClass(size);
+    memcpy(p, &E.buf->pool[c], sizeof(char*));
+    E.buf->pool[c] = p;
+}
+
+/*** syntax highlighting ***/
+
+char* C_HL_extensions[] = {".c", ".h", ".cpp", ".hpp", ".cc", NULL};
+char* C_HL_keywords[] = {
+    "switch",    "if",      "while",   "for",     "break",  "continue",
+    "return",    "else",    "struct",  "union",   "typedef", "static",
+    "enum",      "class",   "case",    "default", "do",     "goto",
+    "sizeof",    "const",   "extern",  "#include", "#define", "#if",
+    "#ifdef",    "#ifndef", "#endif",  "#else",   "int|",   "long|",
+    "double|",   "float|",  "char|",   "unsigned|", "signed|", "void|",
+    "short|",    "size_t|", "bool|",   NULL};
+
+struct editorSyntax HLDB[] = {
+    {"c", C_HL_extensions, C_HL_keywords, "//", "/*", "*/",
+     HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS},
+};
+
+#define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
+
+int editorIsSeparator(int c) {
+    return isspace((unsigned char)c) || c == '\0' ||
+           strchr(",.()+-/*=~%<>[];{}", c) != NULL;
+}
+
+// Whether the wlen bytes of w start at s[i], s is len bytes and may not be
+// NUL terminated
+int editorSyntaxAt(const char* s, int len, int i, const char* w, int wlen) {
+    return wlen && i + wlen <= len && memcmp(&s[i], w, wlen) == 0;
+}
+
+void editorSyntaxMark(unsigned char* hl, int at, int len, unsigned char attr) {
+    if (hl)
+        memset(&hl[at], attr, len);
+}
+
+// Tokenizes len bytes of s starting in state and returns the state at the
+// end. hl gets the attribute of every byte, it can be NULL when only the
+// state is needed. Tabs and the spaces they render to both separate tokens,
+// so chars and render give the same state
+unsigned char editorSyntaxScan(const char* s, int len, unsigned char state,
+                               unsigned char* hl) {
+    struct editorSyntax* syntax = E.buf->syntax;
+    char* scs = syntax->singleline_comment_start;
+    char* mcs = syntax->multiline_comment_start;
+    char* mce = syntax->multiline_comment_end;
+    int scs_len = scs ? strlen(scs) : 0;
+    int mcs_len = mcs ? strlen(mcs) : 0;
+    int mce_len = mce ? strlen(mce) : 0;
+
+    editorSyntaxMark(hl, 0, len, ATTR_NORMAL);
+
+    int prev_sep = 1;
+    int in_string = 0;
+    int in_number = 0;
+    int in_comment = state == HLS_COMMENT;
+
+    int i = 0;
+    while (i < len) {
+        char c = s[i];
+        int prev_number = in_number;
+        in_number = 0;
+
+        if (!in_string && !in_comment &&
+            editorSyntaxAt(s, len, i, scs, scs_len)) {
+            editorSyntaxMark(hl, i, len - i, ATTR_COMMENT);
+            break;
+        }
+
+        if (mcs_len && mce_len && !in_string) {
+            if (in_comment) {
+                if (editorSyntaxAt(s, len, i, mce, mce_len)) {
+                    editorSyntaxMark(hl, i, mce_len, ATTR_COMMENT);
+                    i += mce_len;
+                    in_comment = 0;
+                    prev_sep = 1;
+                } else {
+                    editorSyntaxMark(hl, i, 1, ATTR_COMMENT);
+                    i++;
+                }
+                continue;
+            } else if (editorSyntaxAt(s, len, i, mcs, mcs_len)) {
+                editorSyntaxMark(hl, i, mcs_len, ATTR_COMMENT);
+                i += mcs_len;
+                in_comment = 1;
+                continue;
+            }
+        }
+
+        if (syntax->flags & HL_HIGHLIGHT_STRINGS) {
+            if (in_string) {
+                editorSyntaxMark(hl, i, 1, ATTR_STRING);
+                if (c == '\\' && i + 1 < len) {
+                    editorSyntaxMark(hl, i + 1, 1, ATTR_STRING);
+                    i += 2;
+                    continue;
+                }
+                if (c == in_string)
+                    in_string = 0;
+                i++;
+                prev_sep = 1;
+                continue;
+            } else if (c == '"' || c == '\'') {
+                in_string = c;
+                editorSyntaxMark(hl, i, 1, ATTR_STRING);
+                i++;
+                continue;
+            }
+        }
+
+        if (syntax->flags & HL_HIGHLIGHT_NUMBERS) {
+            if ((isdigit((unsigned char)c) && (prev_sep || prev_number)) ||
+                (c == '.' && prev_number)) {
+                editorSyntaxMark(hl, i, 1, ATTR_NUMBER);
+                i++;
+                in_number = 1;
+                prev_sep = 0;
+                continue;
+            }
+        }
+
+        if (prev_sep) {
+            char** keywords = syntax->keywords;
+            int j;
+            for (j = 0; keywords[j]; j++) {
+                if (keywords[j][0] != c)
+                    continue;
+                int klen = strlen(keywords[j]);
+                int kw2 = keywords[j][klen - 1] == '|';
+                if (kw2)
+                    klen--;
+
+                if (editorSyntaxAt(s, len, i, keywords[j], klen) &&
+                    (i + klen == len || editorIsSeparator(s[i + klen]))) {
+                    editorSyntaxMark(hl, i, klen,
+                                     kw2 ? ATTR_KEYWORD2 : ATTR_KEYWORD1);
+                    i += klen;
+                    break;
+                }
+            }
+            if (keywords[j] != NULL) {
+                prev_sep = 0;
+                continue;
+            }
+        }
+
+        prev_sep = editorIsSeparator(c);
+        i++;
+    }
+
+    return in_comment ? HLS_COMMENT : HLS_NORMAL;
+}
+
+// The text of row at changed
+void editorSyntaxDirty(int at) {
+    if (at < E.buf->hl_valid)
+        E.buf->hl_valid = at;
+    if (at >= E.buf->hl_dirty)
+        E.buf->hl_dirty = at + 1;
+}
+
+// A row was inserted at, the ones after it shift down
+void editorSyntaxInsertRow(int at) {
+    if (at < E.buf->hl_known)
+        E.buf->hl_known++;
+    if (at < E.buf->hl_dirty)
+        E.buf->hl_dirty++;
+    editorSyntaxDirty(at);
+}
+
+// Row at was deleted, the one after it starts from a different state
+void editorSyntaxDelRow(int at) {
+    if (at < E.buf->hl_known)
+        E.buf->hl_known--;
+    if (at < E.buf->hl_dirty)
+        E.buf->hl_dirty--;
+    if (at < E.buf->hl_valid)
+        E.buf->hl_valid = at;
+}
+
+// Stores the state row hl_valid ends in and moves past it. Rescanning
+// starts at the first edited row and stops as soon as a row past the last
+// edited one ends in the state it had before, the rows after it start from
+// the same state as when they were scanned, so their states still hold
+void editorSyntaxSettle(erow* row, unsigned char out) {
+    int same = out == row->hl_state;
+    row->hl_state = out;
+    E.buf->hl_valid++;
+    if (same && E.buf->hl_valid >= E.buf->hl_dirty &&
+        E.buf->hl_known > E.buf->hl_valid)
+        E.buf->hl_valid = E.buf->hl_known;
+    if (E.buf->hl_known < E.buf->hl_valid)
+        E.buf->hl_known = E.buf->hl_valid;
+}
+
+// Brings hl_state of the rows before upto up to date
+void editorSyntaxUpdate(int upto) {
+    while (E.buf->hl_valid < upto) {
+        int at = E.buf->hl_valid;
+        erow* row = editorRow(at);
+        unsigned char in = at ? editorRow(at - 1)->hl_state : HLS_NORMAL;
+        editorSyntaxSettle(row,
+                           editorSyntaxScan(row->chars, row->size, in, NULL));
+    }
+}
+
+// Attributes of the render of row at, NULL without a syntax. Only rebuilt
+// when the row was edited or the state it starts from changed
+unsigned char* editorRowHighlight(int at) {
+    if (E.buf->syntax == NULL)
+        return NULL;
+    editorSyntaxUpdate(at);
+    erow* row = editorRow(at);
+    unsigned char in = at ? editorRow(at - 1)->hl_state : HLS_NORMAL;
+    if (row->hl && row->hl_in == in)
+        return row->hl;
+    if (row->hl == NULL)
+        row->hl = (unsigned char*)editorPoolAlloc(row->rsize + 1, NULL);
+    row->hl_in = in;
+    unsigned char out = editorSyntaxScan(row->render, row->rsize, in, row->hl);
+    // An edited row on screen doesn't need a second scan for its state
+    if (E.buf->hl_valid == at)
+        editorSyntaxSettle(row, out);
+    return row->hl;
+}
+
+// Picks the syntax from the file name, every cached state is dropped
+void editorSelectSyntaxHighlight() {
+    E.buf->syntax = NULL;
+    E.buf->hl_valid = 0;
+    E.buf->hl_known = 0;
+    E.buf->hl_dirty = 0;
+    editorRowsDropRenders();
+    // Highlighting needs the states of every row above
+    if (E.buf->filename == NULL || L->active)
+        return;
+
+    char* ext = strrchr(E.buf->filename, '.');
+    for (unsigned int j = 0; j < HLDB_ENTRIES; j++) {
+        struct editorSyntax* s = &HLDB[j];
+        for (int i = 0; s->filematch[i]; i++) {
+            int is_ext = s->filematch[i][0] == '.';
+            if ((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
+                (!is_ext && strstr(E.buf->filename, s->filematch[i]))) {
+                E.buf->syntax = s;
+                return;
+            }
+        }
+    }
+}
+
+/*** row operations ***/
+
+// Copies a row that still points into the file mapping to the heap, every
+// function that writes to chars has to go through here first
+void editorRowOwn(erow* row) {
+    if (row->cap)
+        return;
+    char* chars = editorPoolAlloc(row->size + 1, &row->cap);
+    memcpy(chars, row->chars, row->size);
+    chars[row->size] = '\0';
+    row->chars = chars;
+}
+
+// Tabs in the index of a row
+#define ROW_TABS(row) ((row)->tabs ? (row)->tabs[0] : 0)
+// Index in chars and rx right after tab i of a row
+#define ROW_TAB_CX(row, i) ((row)->tabs[1 + 2 * (i)])
+#define ROW_TAB_RX(row, i) ((row)->tabs[2 + 2 * (i)])
+
+void editorRowInvalidate(erow* row) {
+    editorPoolFree(row->render, row->rcap);
+    editorPoolFree((char*)row->hl, row->rsize + 1);
+    if (row->tabs)
+        editorPoolFree((char*)row->tabs, (1 + 2 * ROW_TABS(row)) * sizeof(int));
+    row->render = NULL;
+    row->tabs = NULL;
+    row->hl = NULL;
+    row->rsize = 0;
+}
+
+// Builds render and the tab index, the text between two tabs is copied at
+// once
+void editorUpdateRow(erow* row) {
+    int tabs = 0;
+    char* end = row->chars + row->size;
+    for (char* p = row->chars; (p = memchr(p, '\t', end - p)); p++)
+        tabs++;
+
+    editorRowInvalidate(row);
+    row->render = editorPoolAlloc(row->size + tabs * (KILO_TAB_STOP - 1) + 1,
+                                  &row->rcap);
+    if (tabs) {
+        row->tabs = (int*)editorPoolAlloc((1 + 2 * tabs) * sizeof(int), NULL);
+        row->tabs[0] = tabs;
+    }
+
+    int idx = 0;
+    int j = 0;
+    for (int t = 0; t < tabs; t++) {
+        int tab = (char*)memchr(&row->chars[j], '\t', row->size - j) -
+                  row->chars;
+        memcpy(&row->render[idx], &row->chars[j], tab - j);
+        idx += tab - j;
+        row->render[idx++] = ' ';
+        while (idx % KILO_TAB_STOP != 0)
+            row->render[idx++] = ' ';
+        ROW_TAB_CX(row, t) = tab;
+        ROW_TAB_RX(row, t) = idx;
+        j = tab + 1;
+    }
+    memcpy(&row->render[idx], &row->chars[j], row->size - j);
+    idx += row->size - j;
+
+    row->render[idx] = '\0';
+    row->rsize = idx;
+}
+
+// render is only built when a row is drawn or searched, edits just drop it
+void editorRowEnsureRender(erow* row) {
+    if (row->render == NULL)
+        editorUpdateRow(row);
+}
+
+// Converts index of characters into index of rendered characters (tab
+// expanded). Only the chars after the last tab before cx are counted, the
+// tab is found by a binary search
+int editorRowCxToRx(erow* row, int cx) {
+    editorRowEnsureRender(row);
+    int lo = 0, hi = ROW_TABS(row);
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ROW_TAB_CX(row, mid) < cx)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return cx;
+    return ROW_TAB_RX(row, lo - 1) + cx - ROW_TAB_CX(row, lo - 1) - 1;
+}
+
+// Converts index of rendered characters (tab expanded) into index of characters
+int editorRowRxToCs(erow* row, int rx) {
+    editorRowEnsureRender(row);
+    // First tab that ends past rx
+    int lo = 0, hi = ROW_TABS(row);
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ROW_TAB_RX(row, mid) <= rx)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    int cx = lo ? ROW_TAB_CX(row, lo - 1) + 1 : 0;
+    cx += rx - (lo ? ROW_TAB_RX(row, lo - 1) : 0);
+    // Inside the tab itself
+    if (lo < ROW_TABS(row) && cx > ROW_TAB_CX(row, lo))
+        cx = ROW_TAB_CX(row, lo);
+    return cx < row->size ? cx : row->size;
+}
+
+// The text of row changed
+void editorRowChanged(erow* row) {
+    L->edited = 1;
+    editorRowInvalidate(row);
+    editorSyntaxDirty(editorRowIndex(row));
+}
+
+// Whether another view of the buffer keeps the render of row at
+int editorRowShownElsewhere(int at) {
+    for (int i = 0; i < E.nviews; i++) {
+        struct editorView* v = &E.views[i];
+        if (v != E.view && v->buf == E.buf && at >= v->render_lo &&
+            at < v->render_hi)
+            return 1;
+    }
+    return 0;
+}
+
+// Drops the renders of the rows that scrolled out of [lo, hi) of the view
+void editorRowsKeepRenders(int lo, int hi) {
+    if (hi > E.buf->numrows)
+        hi = E.buf->numrows;
+    int end = E.view->render_hi < E.buf->numrows ? E.view->render_hi
+                                                 : E.buf->numrows;
+    for (int j = E.view->render_lo; j < end; j++) {
+        if ((j < lo || j >= hi) && !editorRowShownElsewhere(j))
+            editorRowInvalidate(editorRow(j));
+    }
+    E.view->render_lo = lo;
+    E.view->render_hi = hi;
+}
+
+// Drops every render of the buffer, for all of its views
+void editorRowsDropRenders() {
+    for (int i = 0; i < E.nviews; i++) {
+        struct editorView* v = &E.views[i];
+        if (v->buf != E.buf)
+            continue;
+        int end = v->render_hi < E.buf->numrows ? v->render_hi
+                                                : E.buf->numrows;
+        for (int j = v->render_lo; j < end; j++)
+            editorRowInvalidate(editorRow(j));
+        v->render_lo = v->render_hi = 0;
+    }
+}
+
+// A row was inserted (dir 1) or deleted (dir -1) at at. The cached ranges
+// keep covering the rows they covered, the other views stay on their text
+void editorRowsShiftViews(int at, int dir) {
+    int ins = dir > 0;
+    for (int i = 0; i < E.nviews; i++) {
+        struct editorView* v = &E.views[i];
+        if (v->buf != E.buf)
+            continue;
+        if (at < v->render_lo)
+            v->render_lo += dir;
+        if (at < v->render_hi + ins)
+            v->render_hi += dir;
+        if (v == E.view)
+            continue;
+        if (at < v->cy + ins)
+            v->cy += dir;
+        if (at < v->rowoff)
+            v->rowoff += dir;
+    }
+}
+
+void editorInsertRow(int at, char* s, size_t len) {
+    if (at < 0 || at > E.buf->numrows)
+        return;
+
+    // Slot in the window of a large file
+    int slot = at;
+    if (L->active) {
+        if ((at < L->first || at > L->first + L->count) &&
+            !largeSwapTo(at, 1))
+            largeWindowAt(at);
+        slot = at - L->first;
+        L->count++;
+        L->delta++;
+        L->edited = 1;
+        largeShiftParked(1);
+    }
+
+    if (E.buf->rows.gap_start == E.buf->rows.gap_end)
+        editorRowsGrow();
+    editorRowsMoveGap(slot);
+    erow* row = &E.buf->rows.rows[E.buf->rows.gap_start++];
+
+    row->size = len;
+    row->chars = editorPoolAlloc(len + 1, &row->cap);
+    memcpy(row->chars, s, len);
+    row->chars[len] = '\0';
+
+    row->rsize = 0;
+    row->render = NULL;
+    row->tabs = NULL;
+    row->hl = NULL;
+    row->hl_state = HLS_UNKNOWN;
+    editorSyntaxInsertRow(at);
+    editorRowsShiftViews(at, 1);
+
+    E.buf->numrows++;
+    E.buf->dirty++;
+}
+
+void editorFreeRow(erow* row) {
+    editorRowInvalidate(row);
+    if (row->cap)
+        editorPoolFree(row->chars, row->cap);
+}
+
+void editorDelRow(int at) {
+    if (at < 0 || at >= E.buf->numrows)
+        return;
+    editorFreeRow(editorRow(at));
+    int slot = at;
+    if (L->active) {
+        slot = at - L->first;
+        L->count--;
+        L->delta--;
+        L->edited = 1;
+        largeShiftParked(-1);
+    }
+    // The deleted slot becomes the first one of the gap
+    editorRowsMoveGap(slot);
+    E.buf->rows.gap_end++;
+    editorSyntaxDelRow(at);
+    editorRowsShiftViews(at, -1);
+    E.buf->numrows--;
+    E.buf->dirty++;
+}
+
+// Makes room for need bytes in chars, blocks are powers of two so typing on
+// a line only moves it when the size doubles
+void editorRowReserve(erow* row, int need) {
+    editorRowOwn(row);
+    if (need <= row->cap)
+        return;
+    int cap;
+    char* chars = editorPoolAlloc(need, &cap);
+    memcpy(chars, row->chars, row->size + 1);
+    editorPoolFree(row->chars, row->cap);
+    row->chars = chars;
+    row->cap = cap;
+}
+
+void editorRowInsertString(erow* row, int at, const char* s, int len) {
+    editorRowReserve(row, row->size + len + 1);
+    memmove(&row->chars[at + len], &row->chars[at], row->size - at + 1);
+    memcpy(&row->chars[at], s, len);
+    row->size += len;
+    editorRowChanged(row);
+    E.buf->dirty++;
+}
+
+void editorRowInsertChar(erow* row, int at, int c) {
+    if (at < 0 || at > row->size)
+        at = row->size;
+    char ch = c;
+    editorRowInsertString(row, at, &ch, 1);
+}
+
+void editorRowAppendString(erow* row, char* s, size_t len) {
+    editorRowReserve(row, row->size + len + 1);
+    memcpy(&row->chars[row->size], s, len);
+    row->size += len;
+    row->chars[row->size] = '\0';
+    editorRowChanged(row);
+    E.buf->dirty++;
+}
+
+void editorRowDelChars(erow* row, int at, int len) {
+    editorRowOwn(row);
+    memmove(&row->chars[at], &row->chars[at + len], row->size - at - len + 1);
+    row->size -= len;
+    editorRowChanged(row);
+    E.buf->dirty++;
+}
+
+void editorRowDelChar(erow* row, int at) {
+    if (at < 0 || at >= row->size)
+        return;
+    editorRowDelChars(row, at, 1);
+}
+
+// Breaks row at in two at col, a split at 0 just inserts an empty row above
+// so a mapped line is not copied
+void editorRowSplit(int at, int col) {
+    if (col == 0) {
+        editorInsertRow(at, "", 0);
+        return;
+    }
+    erow* row = editorRow(at);
+    editorInsertRow(at + 1, &row->chars[col], row->size - col);
+    row = editorRow(at);
+    editorRowOwn(row);
+    row->size = col;
+    row->chars[row->size] = '\0';
+    editorRowChanged(row);
+}
+
+// Appends row at + 1 to row at and removes it
+void editorRowJoin(int at) {
+    erow* row = editorRow(at);
+    erow* next = editorRow(at + 1);
+    editorRowAppendString(row, next->chars, next->size);
+    editorDelRow(at + 1);
+}
+
+/*** undo ***/
+
+// The journal is a log of operations in its own arena, one record per edit
+// followed by the text it inserted or deleted. Consecutive inserts and
+// backspaces on a row grow the last record in place, so typing costs a few
+// bytes per character and undoing a paste only touches the pasted text.
+enum undoKind {
+    UNDO_INSERT,    // text was inserted at row, col
+    UNDO_DELETE,    // text was deleted at row, col
+    UNDO_SPLIT,     // row was broken at col
+    UNDO_JOIN,      // row + 1 was appended to row, it started at col
+    UNDO_ROW_INSERT // an empty row was inserted at row
+};
+
+typedef struct undoOp {
+    u32 prev;  // offset of the record before, 0 for the first
+    u8 kind;   // enum undoKind
+    u8 chain;  // undone and redone together with the record before
+    u16 unused;
+    i32 row;
+    i32 col;
+    i32 len; // bytes of text following the record
+} undoOp;
+
+#define UNDO_ALIGN sizeof(void*)
+#define UNDO_FIRST ((sizeof(mem_arena) + UNDO_ALIGN - 1) & ~(UNDO_ALIGN - 1))
+
+undoOp* undoAt(u32 off) { return (undoOp*)((u8*)E.buf->undo + off); }
+
+char* undoText(undoOp* op) { return (char*)(op + 1); }
+
+// Offset of the record after the one at off, 0 stands for none yet
+u32 undoNext(u32 off) {
+    if (off == 0)
+        return UNDO_FIRST;
+    u64 end = off + sizeof(undoOp) + undoAt(off)->len;
+    return (end + UNDO_ALIGN - 1) & ~(UNDO_ALIGN - 1);
+}
+
+void undoReset() {
+    arena_clear(E.buf->undo);
+    E.buf->undo_top = 0;
+}
+
+// Drops the records that were undone, a new edit replaces them
+void undoTruncate() {
+    u64 top = E.buf->undo_top;
+    u64 end = top ? top + sizeof(undoOp) + undoAt(top)->len : UNDO_FIRST;
+    if (E.buf->undo->pos > end)
+        arena_pop_to(E.buf->undo, end);
+}
+
+void undoPush(int kind, int row, int col, const char* text, int len,
+              int chain) {
+    undoTruncate();
+    undoOp* op = arena_push(E.buf->undo, sizeof(undoOp) + len, true);
+    if (op == NULL) {
+        undoReset();
+        return;
+    }
+    op->prev = E.buf->undo_top;
+    op->kind = kind;
+    op->chain = chain;
+    op->unused = 0;
+    op->row = row;
+    op->col = col;
+    op->len = len;
+    if (len)
+        memcpy(undoText(op), text, len);
+    E.buf->undo_top = (u8*)op - (u8*)E.buf->undo;
+}
+
+// Makes room for one more byte of text in the last record, which sits at
+// the end of the arena
+undoOp* undoGrow() {
+    undoOp* op = undoAt(E.buf->undo_top);
+    u64 size = sizeof(undoOp) + op->len;
+    arena_pop(E.buf->undo, size);
+    if (arena_push(E.buf->undo, size + 1, true) == NULL) {
+        undoReset();
+        return NULL;
+    }
+    return op;
+}
+
+// The last record if it is of kind and nothing was undone after it
+undoOp* undoLast(int kind, int row) {
+    if (E.buf->undo_top == 0 || undoNext(E.buf->undo_top) < E.buf->undo->pos)
+        return NULL;
+    undoOp* op = undoAt(E.buf->undo_top);
+    if (op->kind != kind || op->row != row)
+        return NULL;
+    return op;
+}
+
+void undoInsert(int row, int col, char c, int chain) {
+    undoOp* op = undoLast(UNDO_INSERT, row);
+    if (!chain && op && op->col + op->len == col && (op = undoGrow())) {
+        undoText(op)[op->len++] = c;
+        return;
+    }
+    undoPush(UNDO_INSERT, row, col, &c, 1, chain);
+}
+
+void undoDelete(int row, int col, char c) {
+    undoOp* op = undoLast(UNDO_DELETE, row);
+    if (op && col + 1 == op->col && (op = undoGrow())) {
+        memmove(undoText(op) + 1, undoText(op), op->len);
+        undoText(op)[0] = c;
+        op->len++;
+        op->col--;
+        return;
+    }
+    undoPush(UNDO_DELETE, row, col, &c, 1, 0);
+}
+
+// Applies or reverts one record and leaves the cursor where the edit was
+void undoApply(undoOp* op, int redo) {
+    switch (op->kind) {
+    case UNDO_INSERT:
+        if (redo)
+            editorRowInsertString(editorRow(op->row), op->col, undoText(op),
+                                  op->len);
+        else
+            editorRowDelChars(editorRow(op->row), op->col, op->len);
+        E.view->cy = op->row;
+        E.view->cx = op->col + (redo ? op->len : 0);
+        break;
+    case UNDO_DELETE:
+        if (redo)
+            editorRowDelChars(editorRow(op->row), op->col, op->len);
+        else
+            editorRowInsertString(editorRow(op->row), op->col, undoText(op),
+                                  op->len);
+        E.view->cy = op->row;
+        E.view->cx = op->col + (redo ? 0 : op->len);
+        break;
+    case UNDO_SPLIT:
+    case UNDO_JOIN:
+        if (redo == (op->kind == UNDO_SPLIT)) {
+            editorRowSplit(op->row, op->col);
+            E.view->cy = op->row + 1;
+            E.view->cx = 0;
+        } else {
+            editorRowJoin(op->row);
+            E.view->cy = op->row;
+            E.view->cx = op->col;
+        }
+        break;
+    case UNDO_ROW_INSERT:
+        if (redo)
+            editorInsertRow(op->row, "", 0);
+        else
+            editorDelRow(op->row);
+        E.view->cy = op->row;
+        E.view->cx = 0;
+        break;
+    }
+}
+
+void editorUndo() {
+    if (E.buf->undo_top == 0) {
+        editorSetStatusMessage("Nothing to undo");
+        return;
+    }
+    undoOp* op;
+    do {
+        op = undoAt(E.buf->undo_top);
+        undoApply(op, 0);
+        E.buf->undo_top = op->prev;
+    } while (op->chain);
+}
+
+void editorRedo() {
+    u32 next = undoNext(E.buf->undo_top);
+    if (next >= E.buf->undo->pos) {
+        editorSetStatusMessage("Nothing to redo");
+        return;
+    }
+    do {
+        undoApply(undoAt(next), 1);
+        E.buf->undo_top = next;
+        next = undoNext(next);
+    } while (next < E.buf->undo->pos && undoAt(next)->chain);
+}
+
+/*** editor operations ***/
+void editorInsertChar(int c) {
+    int chain = 0;
+    if (E.view->cy == E.buf->numrows) {
+        editorInsertRow(E.buf->numrows, "", 0);
+        undoPush(UNDO_ROW_INSERT, E.view->cy, 0, NULL, 0, 0);
+        chain = 1;
+    }
+    editorRowInsertChar(editorRow(E.view->cy), E.view->cx, c);
+    undoInsert(E.view->cy, E.view->cx, c, chain);
+    E.view->cx++;
+}
+
+void editorInsertNewline() {
+    if (E.view->cy == E.buf->numrows) {
+        editorInsertRow(E.view->cy, "", 0);
+        undoPush(UNDO_ROW_INSERT, E.view->cy, 0, NULL, 0, 0);
+    } else {
+        editorRowSplit(E.view->cy, E.view->cx);
+        undoPush(UNDO_SPLIT, E.view->cy, E.view->cx, NULL, 0, 0);
+    }
+    E.view->cy++;
+    E.view->cx = 0;
+}
+
+void editorDelChar() {
+    if (E.view->cy == E.buf->numrows)
+        return;
+    if (E.view->cx == 0 && E.view->cy == 0)
+        return;
+
+    erow* row = editorRow(E.view->cy);
+    if (E.view->cx > 0) {
+        char c = row->chars[E.view->cx - 1];
+        editorRowDelChar(row, E.view->cx - 1);
+        E.view->cx--;
+        undoDelete(E.view->cy, E.view->cx, c);
+    } else {
+        E.view->cx = editorRow(E.view->cy - 1)->size;
+        editorRowJoin(E.view->cy - 1);
+        E.view->cy--;
+        undoPush(UNDO_JOIN, E.view->cy, E.view->cx, NULL, 0, 0);
+    }
+}
+
+/*** file i/o ***/
+
+// Counts '\n' in p, 16 bytes per compare
+size_t editorCountNewlines(const char* p, size_t len) {
+    size_t count = 0;
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)&p[i]);
+        count += __builtin_popcount(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, nl)));
+    }
+#endif
+    for (; i < len; i++)
+        count += p[i] == '\n';
+    return count;
+}
+
+// Every row, render and the row array live in the buffer arena, so dropping
+// the buffer is a single arena_clear
+void editorCloseBuffer() {
+    largeClose();
+    if (E.buf->map) {
+        munmap(E.buf->map, E.buf->maplen);
+        E.buf->map = NULL;
+        E.buf->maplen = 0;
+    }
+    arena_clear(E.buf->arena);
+    memset(E.buf->pool, 0, sizeof(E.buf->pool));
+    E.buf->rows = (rowbuf){NULL, 0, 0, 0};
+    E.buf->numrows = 0;
+    editorRowsDropRenders();
+    E.buf->dirty = 0;
+    undoReset();
+}
+
+// Reads what can't be mapped, a pipe or a /proc file that reports no size,
+// into rows of their own
+void editorReadRows(int fd) {
+    size_t cap = 4096, len = 0;
+    char* buf = malloc(cap);
+    if (buf == NULL)
+        die("malloc");
+    while (1) {
+        if (len == cap) {
+            cap *= 2;
+            buf = realloc(buf, cap);
+            if (buf == NULL)
+                die("realloc");
+        }
+        ssize_t n = read(fd, buf + len, cap - len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1)
+            die("read");
+        if (n == 0)
+            break;
+        len += n;
+    }
+
+    char* p = buf;
+    char* end = buf + len;
+    while (p < end) {
+        char* nl = memchr(p, '\n', end - p);
+        char* eol = nl ? nl : end;
+        size_t rowlen = eol - p;
+        while (rowlen > 0 && (p[rowlen - 1] == '\n' || p[rowlen - 1] == '\r'))
+            rowlen--;
+        editorInsertRow(E.buf->numrows, p, rowlen);
+        p = nl ? nl + 1 : end;
+    }
+    free(buf);
+}
+
+// Maps the file and indexes it with an erow per line pointing straight into
+// the mapping, no line is copied or rendered until it is drawn or edited.
+// Files too large for that index open windowed, see largeOpen()
+void editorOpen(char* filename) {
+    editorCloseBuffer();
+    free(E.buf->filename);
+    E.buf->filename = strdup(filename);
+    editorSelectSyntaxHighlight();
+
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        die("open");
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+        die("fstat");
+
+    if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+        editorReadRows(fd);
+        close(fd);
+        E.buf->dirty = 0;
+        return;
+    }
+    E.buf->maplen = st.st_size;
+
+    E.buf->map = mmap(NULL, E.buf->maplen, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (E.buf->map == MAP_FAILED) {
+        E.buf->map = NULL;
+        die("mmap");
+    }
+    // Rows for every line, plus a last line without '\n'. A large file is
+    // never scanned here, its line counter does that in the background
+    size_t nlines = 0;
+    if (E.buf->maplen < LARGE_FILE_MIN && !large_forced)
+        nlines = editorCountNewlines(E.buf->map, E.buf->maplen) + 1;
+    if (nlines == 0 || nlines > LARGE_INDEX_ROWS) {
+        largeOpen(fd);
+        close(fd);
+        E.buf->dirty = 0;
+        return;
+    }
+    // The mapping keeps the file alive, the descriptor isn't needed anymore
+    close(fd);
+    madvise(E.buf->map, E.buf->maplen, MADV_SEQUENTIAL);
+
+    // One allocation for the whole index
+    E.buf->rows.rows = PUSH_ARRAY_NZ(E.buf->arena, erow, nlines);
+    if (E.buf->rows.rows == NULL)
+        die("arena_push");
+    E.buf->rows.cap = nlines;
+    E.buf->rows.gap_start = 0;
+    E.buf->rows.gap_end = nlines;
+
+    char* p = E.buf->map;
+    char* end = E.buf->map + E.buf->maplen;
+    while (p < end) {
+        char* nl = memchr(p, '\n', end - p);
+        char* eol = nl ? nl : end;
+
+        // Row without the \n or \r
+        size_t len = eol - p;
+        while (len > 0 && (p[len - 1] == '\n' || p[len - 1] == '\r'))
+            len--;
+
+        erow* row = &E.buf->rows.rows[E.buf->rows.gap_start++];
+        row->size = len;
+        row->cap = 0;
+        row->rsize = 0;
+        row->chars = p;
+        row->render = NULL;
+        row->tabs = NULL;
+        row->hl = NULL;
+        row->hl_state = HLS_UNKNOWN;
+
+        p = nl ? nl + 1 : end;
+    }
+    E.buf->numrows = E.buf->rows.gap_start;
+    E.buf->dirty = 0;
+}
+
+// Rows handed to writev at once, two iovecs each
+#define SAVE_BATCH_ROWS 512
+
+// Writes all of iov, writev may stop anywhere in the middle
+int editorWritev(int fd, struct iovec* iov, int cnt) {
+    while (cnt > 0) {
+        ssize_t n = writev(fd, iov, cnt);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        while (cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+// Streams the rows straight from their storage, no copy of the file is
+// built. Returns the bytes written or -1
+long long editorWriteRows(int fd) {
+    static const char newline = '\n';
+    struct iovec iov[SAVE_BATCH_ROWS * 2];
+    long long total = 0;
+    int cnt = 0;
+
+    for (int j = 0; j < E.buf->numrows; j++) {
+        erow* row = editorRow(j);
+        iov[cnt].iov_base = row->chars;
+        iov[cnt].iov_len = row->size;
+        iov[cnt + 1].iov_base = (void*)&newline;
+        iov[cnt + 1].iov_len = 1;
+        cnt += 2;
+        total += row->size + 1;
+        if (cnt == SAVE_BATCH_ROWS * 2 || j == E.buf->numrows - 1) {
+            if (editorWritev(fd, iov, cnt) == -1)
+                return -1;
+            cnt = 0;
+        }
+    }
+    return total;
+}
+
+// Writes to a temporary file next to the target and renames it over it, so
+// the file is either the old or the new version even after a crash. The old
+// inode lives on while it's mapped, rows pointing into E.buf->map stay valid
+void editorSave() {
+    if (E.buf->filename == NULL) {
+        E.buf->filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
+        if (E.buf->filename == NULL) {
+            editorSetStatusMessage("Save aborted");
+            return;
+        }
+        editorSelectSyntaxHighlight();
+        return;
+    }
+
+    // Save through symlinks instead of replacing them
+    char* target = realpath(E.buf->filename, NULL);
+    if (target == NULL)
+        target = strdup(E.buf->filename);
+    if (target == NULL)
+        die("strdup");
+
+    // Same directory so rename doesn't cross file systems
+    char* slash = strrchr(target, '/');
+    int dirlen = slash ? slash - target + 1 : 0;
+    char* tmp = malloc(strlen(target) + 16);
+    char* dir = malloc(dirlen + 2);
+    if (tmp == NULL || dir == NULL)
+        die("malloc");
+    sprintf(tmp, "%.*s.%s.XXXXXX", dirlen, target, target + dirlen);
+    if (dirlen)
+        sprintf(dir, "%.*s", dirlen, target);
+    else
+        strcpy(dir, ".");
+
+    long long len = -1;
+    int fd = mkstemp(tmp);
+    if (fd != -1) {
+        // Keep the permissions of the file, or the default for a new one
+        struct stat st;
+        mode_t mode;
+        if (stat(target, &st) == 0) {
+            mode = st.st_mode & 07777;
+        } else {
+            mode_t mask = umask(0);
+            umask(mask);
+            mode = 0666 & ~mask;
+        }
+
+        len = L->active ? largeWriteRows(fd) : editorWriteRows(fd);
+        if (len != -1 && (fchmod(fd, mode) == -1 || fsync(fd) == -1))
+            len = -1;
+        if (close(fd) == -1)
+            len = -1;
+        if (len != -1 && rename(tmp, target) == -1)
+            len = -1;
+        if (len == -1) {
+            int err = errno;
+            unlink(tmp);
+            errno = err;
+        }
+    }
+
+    if (len != -1) {
+        // The rename itself is only durable once the directory is synced
+        int dfd = open(dir, O_RDONLY | O_DIRECTORY);
+        if (dfd != -1) {
+            fsync(dfd);
+            close(dfd);
+        }
+        E.buf->dirty = 0;
+        editorSetStatusMessage("%lld bytes written to disk", len);
+    } else {
+        editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+    }
+
+    free(target);
+    free(tmp);
+    free(dir);
+}
+
+/*** regex ***/
+
+// Regular expressions for search: literals, ., [] classes with ranges and ^,
+// \d \w \s (and \D \W \S), escapes, * + ?, | and (). ^ and $ are only
+// anchors at the start and end of the whole pattern. The pattern becomes a
+// Thompson NFA and that a DFA over byte classes, matching never backtracks
+
+#define RE_MAX_NODES 1024
+#define RE_MAX_STATES 4096
+
+enum reNodeType { RE_SET, RE_EPS, RE_SPLIT, RE_MATCH };
+
+typedef struct reNode {
+    int type;              // enum reNodeType
+    int out;               // next node
+    int out1;              // other branch of a RE_SPLIT
+    unsigned char set[32]; // bytes a RE_SET accepts, one bit each
+} reNode;
+
+// State 0 is the dead state, 1 the start state
+typedef struct reDfa {
+    int nstates;
+    int* next;             // nstates * nclasses transitions
+    unsigned char* accept; // state has matched
+} reDfa;
+
+typedef struct regex {
+    int anchor_start;           // pattern started with ^
+    int anchor_end;             // pattern ended with $
+    int nclasses;               // bytes no set tells apart share a class
+    unsigned char classes[256]; // class of every byte
+    reDfa anchored;             // matches starting at a given position
+    reDfa search;               // matches starting anywhere, to skip rows
+} regex;
+
+typedef struct reParser {
+    const char* p;   // next char of the pattern
+    const char* end; // end of the pattern
+    reNode* nodes;
+    int nnodes;
+    const char* err; // set on the first error
+} reParser;
+
+// Piece of NFA, end is a RE_EPS whose out still has to be set
+typedef struct reFrag {
+    int start;
+    int end;
+} reFrag;
+
+static const reFrag RE_FAIL = {-1, -1};
+
+// Bit sets, of bytes for RE_SET and of nodes for DFA states
+void reSetAdd(unsigned char* set, int c) {
+    set[c >> 3] |= 1 << (c & 7);
+}
+
+int reSetHas(const unsigned char* set, int c) {
+    return set[c >> 3] & (1 << (c & 7));
+}
+
+int reNew(reParser* rp, int type) {
+    if (rp->nnodes == RE_MAX_NODES) {
+        rp->err = "regex too long";
+        return -1;
+    }
+    reNode* n = &rp->nodes[rp->nnodes];
+    n->type = type;
+    n->out = -1;
+    n->out1 = -1;
+    memset(n->set, 0, sizeof(n->set));
+    return rp->nnodes++;
+}
+
+// \d \w \s, their negations or the escaped char itself
+void reEscape(unsigned char c, unsigned char* set) {
+    unsigned char tmp[32] = {0};
+    int lower = tolower(c);
+
+    if (lower == 'd' || lower == 'w' || lower == 's') {
+        for (int b = 0; b < 256; b++) {
+            if ((lower == 'd' && isdigit(b)) ||
+                (lower == 'w' && (isalnum(b) || b == '_')) ||
+                (lower == 's' && isspace(b)))
+                reSetAdd(tmp, b);
+        }
+        for (int j = 0; j < 32; j++)
+            set[j] |= (c == lower) ? tmp[j] : (unsigned char)~tmp[j];
+    } else if (c == 't') {
+        reSetAdd(set, '\t');
+    } else {
+        reSetAdd(set, c);
+    }
+}
+
+// [abc], [a-z], [^...], called after the [
+int reParseClass(reParser* rp, unsigned char* set) {
+    unsigned char tmp[32] = {0};
+    int negate = 0;
+    int first = 1;
+
+    if (rp->p < rp->end && *rp->p == '^') {
+        negate = 1;
+        rp->p++;
+    }
+    while (rp->p < rp->end && (*rp->p != ']' || first)) {
+        unsigned char lo = *rp->p++;
+        first = 0;
+        if (lo == '\\' && rp->p < rp->end) {
+            reEscape(*rp->p++, tmp);
+            continue;
+        }
+        if (rp->p + 1 < rp->end && rp->p[0] == '-' && rp->p[1] != ']') {
+            unsigned char hi = rp->p[1];
+            rp->p += 2;
+            for (int b = lo; b <= hi; b++)
+                reSetAdd(tmp, b);
+        } else {
+            reSetAdd(tmp, lo);
+        }
+    }
+    if (rp->p == rp->end) {
+        rp->err = "missing ]";
+        return 0;
+    }
+    rp->p++;
+    for (int j = 0; j < 32; j++)
+        set[j] |= negate ? (unsigned char)~tmp[j] : tmp[j];
+    return 1;
+}
+
+reFrag reParseAlt(reParser* rp);
+
+reFrag reParseAtom(reParser* rp) {
+    char c = *rp->p++;
+
+    if (c == '(') {
+        reFrag f = reParseAlt(rp);
+        if (f.start < 0)
+            return f;
+        if (rp->p == rp->end || *rp->p != ')') {
+            rp->err = "missing )";
+            return RE_FAIL;
+        }
+        rp->p++;
+        return f;
+    }
+    if (c == '*' || c == '+' || c == '?') {
+        rp->err = "nothing to repeat";
+        return RE_FAIL;
+    }
+
+    int s = reNew(rp, RE_SET);
+    int e = reNew(rp, RE_EPS);
+    if (e < 0)
+        return RE_FAIL;
+    unsigned char* set = rp->nodes[s].set;
+    rp->nodes[s].out = e;
+
+    if (c == '.') {
+        memset(set, 0xff, 32);
+    } else if (c == '[') {
+        if (!reParseClass(rp, set))
+            return RE_FAIL;
+    } else if (c == '\\') {
+        if (rp->p == rp->end) {
+            rp->err = "trailing \\";
+            return RE_FAIL;
+        }
+        reEscape(*rp->p++, set);
+    } else {
+        reSetAdd(set, c);
+    }
+    return (reFrag){s, e};
+}
+
+reFrag reParseRepeat(reParser* rp) {
+    reFrag a = reParseAtom(rp);
+    while (a.start >= 0 && rp->p < rp->end &&
+           (*rp->p == '*' || *rp->p == '+' || *rp->p == '?')) {
+        char op = *rp->p++;
+        int s = reNew(rp, RE_SPLIT);
+        int e = reNew(rp, RE_EPS);
+        if (e < 0)
+            return RE_FAIL;
+        rp->nodes[s].out = a.start;
+        rp->nodes[s].out1 = e;
+        // ? skips a once, * and + loop back to the split
+        rp->nodes[a.end].out = op == '?' ? e : s;
+        if (op != '+')
+            a.start = s;
+        a.end = e;
+    }
+    return a;
+}
+
+reFrag reParseConcat(reParser* rp) {
+    int e = reNew(rp, RE_EPS);
+    if (e < 0)
+        return RE_FAIL;
+    reFrag f = {e, e};
+    while (rp->p < rp->end && *rp->p != '|' && *rp->p != ')') {
+        reFrag b = reParseRepeat(rp);
+        if (b.start < 0)
+            return b;
+        rp->nodes[f.end].out = b.start;
+        f.end = b.end;
+    }
+    return f;
+}
+
+reFrag reParseAlt(reParser* rp) {
+    reFrag a = reParseConcat(rp);
+    while (a.start >= 0 && rp->p < rp->end && *rp->p == '|') {
+        rp->p++;
+        reFrag b = reParseConcat(rp);
+        if (b.start < 0)
+            return b;
+        int s = reNew(rp, RE_SPLIT);
+        int e = reNew(rp, RE_EPS);
+        if (e < 0)
+            return RE_FAIL;
+        rp->nodes[s].out = a.start;
+        rp->nodes[s].out1 = b.start;
+        rp->nodes[a.end].out = e;
+        rp->nodes[b.end].out = e;
+        a = (reFrag){s, e};
+    }
+    return a;
+}
+
+// Scratch space of the subset construction
+typedef struct reBuilder {
+    const reNode* nodes;
+    int nnodes;
+    int setbytes;        // bytes of a set of nodes
+    unsigned char* sets; // node set of every DFA state
+    int* hash;           // state of every slot, -1 for free
+    int hashsize;
+    unsigned char* seen; // nodes visited by the current closure
+    int* stack;
+} reBuilder;
+
+// Adds the RE_SET and RE_MATCH nodes reachable from n without reading a
+// byte to bits
+void reClosure(reBuilder* b, int n, unsigned char* bits) {
+    int top = 0;
+    b->stack[top++] = n;
+    while (top) {
+        n = b->stack[--top];
+        if (n < 0 || reSetHas(b->seen, n))
+            continue;
+        reSetAdd(b->seen, n);
+        switch (b->nodes[n].type) {
+        case RE_SPLIT:
+            b->stack[top++] = b->nodes[n].out1;
+            b->stack[top++] = b->nodes[n].out;
+            break;
+        case RE_EPS:
+            b->stack[top++] = b->nodes[n].out;
+            break;
+        default:
+            reSetAdd(bits, n);
+        }
+    }
+}
+
+// Returns the state holding set, adding it if it's new. -1 when there are
+// too many states
+int reDfaState(reBuilder* b, reDfa* d, const unsigned char* set) {
+    unsigned h = 2166136261u;
+    for (int j = 0; j < b->setbytes; j++)
+        h = (h ^ set[j]) * 16777619u;
+    for (h %= b->hashsize; b->hash[h] >= 0; h = (h + 1) % b->hashsize) {
+        if (memcmp(&b->sets[b->hash[h] * b->setbytes], set, b->setbytes) == 0)
+            return b->hash[h];
+    }
+    if (d->nstates == RE_MAX_STATES)
+        return -1;
+    memcpy(&b->sets[d->nstates * b->setbytes], set, b->setbytes);
+    b->hash[h] = d->nstates;
+    return d->nstates++;
+}
+
+// Splits the bytes into classes, two bytes share one if every RE_SET either
+// has both or neither
+void reClasses(regex* re, const reNode* nodes, int nnodes) {
+    memset(re->classes, 0, sizeof(re->classes));
+    re->nclasses = 1;
+    for (int n = 0; n < nnodes; n++) {
+        if (nodes[n].type != RE_SET)
+            continue;
+        int map[512];
+        int count = 0;
+        for (int j = 0; j < 512; j++)
+            map[j] = -1;
+        for (int b = 0; b < 256; b++) {
+            int key = re->classes[b] * 2 + (reSetHas(nodes[n].set, b) != 0);
+            if (map[key] < 0)
+                map[key] = count++;
+            re->classes[b] = map[key];
+        }
+        re->nclasses = count;
+    }
+}
+
+// Subset construction, states are numbered in the order they're found so
+// the dead state (empty set) is 0 and the start 1. With search set the start
+// is added back after every byte, as if the pattern began with .*
+const char* reDfaBuild(regex* re, const reNode* nodes, int nnodes, int start,
+                       int match, int search, reDfa* d) {
+    reBuilder b;
+    b.nodes = nodes;
+    b.nnodes = nnodes;
+    b.setbytes = (nnodes + 7) / 8;
+    b.sets = malloc(RE_MAX_STATES * b.setbytes);
+    b.hashsize = RE_MAX_STATES * 2;
+    b.hash = malloc(sizeof(int) * b.hashsize);
+    b.seen = malloc(b.setbytes);
+    b.stack = malloc(sizeof(int) * (nnodes * 2 + 1));
+    unsigned char* set = malloc(b.setbytes);
+    int ncl = re->nclasses;
+    int rep[256];
+    const char* err = NULL;
+
+    d->nstates = 0;
+    d->next = malloc(sizeof(int) * RE_MAX_STATES * ncl);
+    d->accept = malloc(RE_MAX_STATES);
+    if (!b.sets || !b.hash || !b.seen || !b.stack || !set || !d->next ||
+        !d->accept)
+        die("malloc");
+    for (int j = 0; j < b.hashsize; j++)
+        b.hash[j] = -1;
+    // A byte standing for each class
+    for (int c = 255; c >= 0; c--)
+        rep[re->classes[c]] = c;
+
+    memset(set, 0, b.setbytes);
+    reDfaState(&b, d, set);
+    memset(b.seen, 0, b.setbytes);
+    reClosure(&b, start, set);
+    reDfaState(&b, d, set);
+
+    for (int i = 0; i < d->nstates && err == NULL; i++) {
+        const unsigned char* cur = &b.sets[i * b.setbytes];
+        d->accept[i] = reSetHas(cur, match) != 0;
+
+        for (int c = 0; c < ncl; c++) {
+            memset(set, 0, b.setbytes);
+            memset(b.seen, 0, b.setbytes);
+            for (int n = 0; n < nnodes; n++) {
+                if (reSetHas(cur, n) && nodes[n].type == RE_SET &&
+                    reSetHas(nodes[n].set, rep[c]))
+                    reClosure(&b, nodes[n].out, set);
+            }
+            if (search && i != 0)
+                reClosure(&b, start, set);
+
+            int id = reDfaState(&b, d, set);
+            if (id < 0) {
+                err = "regex too complex";
+                break;
+            }
+            d->next[i * ncl + c] = id;
+        }
+    }
+
+    free(b.sets);
+    free(b.hash);
+    free(b.seen);
+    free(b.stack);
+    free(set);
+    return err;
+}
+
+void reFree(regex* re) {
+    free(re->anchored.next);
+    free(re->anchored.accept);
+    free(re->search.next);
+    free(re->search.accept);
+    memset(re, 0, sizeof(*re));
+}
+
+// Returns NULL or what is wrong with pattern
+const char* reCompile(regex* re, const char* pattern) {
+    int len = strlen(pattern);
+    memset(re, 0, sizeof(*re));
+
+    if (len && pattern[0] == '^') {
+        re->anchor_start = 1;
+        pattern++;
+        len--;
+    }
+    if (len && pattern[len - 1] == '$' && (len < 2 || pattern[len - 2] != '\\')) {
+        re->anchor_end = 1;
+        len--;
+    }
+
+    reParser rp = {pattern, pattern + len, malloc(sizeof(reNode) * RE_MAX_NODES),
+                   0, NULL};
+    if (rp.nodes == NULL)
+        die("malloc");
+
+    reFrag f = reParseAlt(&rp);
+    if (f.start >= 0 && rp.p != rp.end)
+        rp.err = "unmatched )";
+    int match = -1;
+    if (rp.err == NULL) {
+        match = reNew(&rp, RE_MATCH);
+        if (match >= 0)
+            rp.nodes[f.end].out = match;
+    }
+    if (rp.err == NULL) {
+        reClasses(re, rp.nodes, rp.nnodes);
+        rp.err = reDfaBuild(re, rp.nodes, rp.nnodes, f.start, match, 0,
+                            &re->anchored);
+    }
+    if (rp.err == NULL)
+        rp.err = reDfaBuild(re, rp.nodes, rp.nnodes, f.start, match, 1,
+                            &re->search);
+
+    free(rp.nodes);
+    if (rp.err)
+        reFree(re);
+    return rp.err;
+}
+
+// Length of the longest match starting at s[i], -1 if there is none
+int reMatchAt(const regex* re, const char* s, int len, int i) {
+    const reDfa* d = &re->anchored;
+    int state = 1;
+    int best = -1;
+
+    if (d->accept[state] && (!re->anchor_end || i == len))
+        best = 0;
+    for (int j = i; j < len; j++) {
+        state = d->next[state * re->nclasses + re->classes[(unsigned char)s[j]]];
+        if (state == 0)
+            break;
+        if (d->accept[state] && (!re->anchor_end || j + 1 == len))
+            best = j + 1 - i;
+    }
+    return best;
+}
+
+// One pass over s telling whether anything in it matches
+int reSearch(const regex* re, const char* s, int len) {
+    const reDfa* d = &re->search;
+    int state = 1;
+
+    if (!re->anchor_end && d->accept[state])
+        return 1;
+    for (int j = 0; j < len; j++) {
+        state = d->next[state * re->nclasses + re->classes[(unsigned char)s[j]]];
+        if (!re->anchor_end && d->accept[state])
+            return 1;
+    }
+    return d->accept[state];
+}
+
+/*** find ***/
+
+// A job stops handing out chunks past this many matches, the rest of the
+// file is scanned when moving past the last match
+#define FIND_MAX_MATCHES (1 << 22)
+// Rows a worker takes at once
+#define FIND_CHUNK_ROWS 4096
+#define FIND_MAX_THREADS 8
+
+typedef struct findMatch {
+    int row; // file row
+    int col; // index in chars
+} findMatch;
+
+typedef struct findBuf {
+    findMatch* m;
+    int len;
+    int cap;
+} findBuf;
+
+typedef struct findChunk {
+    findBuf buf; // matches of the chunk, owned by the worker until done
+    int done;    // set (release) by the worker once buf is complete
+} findChunk;
+
+// Search workers. A job splits rows [first_row, numrows) in chunks that
+// are handed out in order, each worker fills the chunks it takes. Bumping
+// gen cancels the job, workers check it before every row
+struct findPool {
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // a job was started
+    pthread_cond_t idle; // no worker is inside a job anymore
+    int nthreads;        // 0 until the first search starts them
+    int active;          // workers inside a job
+    int job;             // gen of the last started job
+    int gen;             // current generation
+    rowbuf rows; // storage of the searched buffer, E changes with the view
+    int base;    // buffer row of rows.rows[0]
+    int first_row;
+    int numrows;
+    int nchunks;
+    int next_chunk; // next chunk to hand out
+    int found;      // matches of the finished chunks
+    int limit;      // no chunks are handed out past this many matches
+    findChunk* chunks;
+    int cap_chunks;
+} FP = {.lock = PTHREAD_MUTEX_INITIALIZER,
+        .wake = PTHREAD_COND_INITIALIZER,
+        .idle = PTHREAD_COND_INITIALIZER};
+
+enum findPending { FIND_NONE, FIND_FIRST, FIND_NEXT, FIND_LAST };
+
+// Query and matches of the current search, the UI side of the pool
+struct findState {
+    char* query;        // what the matches belong to
+    int qlen;           // length of query
+    int qcap;           // allocated bytes of query
+    int regex;          // query is a regular expression, toggled with Tab
+    regex re;           // compiled query when regex is set
+    const char* err;    // why query doesn't compile
+    findBuf hits;       // matches of rows [0, scanned) in file order
+    int scanned;        // rows covered by hits
+    int running;        // a job is still adding to hits
+    int merged;         // chunks of the job moved into hits
+    int current;        // selected match, -1 for none
+    int pending;        // enum findPending, move once the matches arrive
+    char prompt[80];    // prompt with the mode and number of matches
+} F = {NULL, 0, 0, 0, {0}, NULL, {NULL, 0, 0}, 0, 0, 0, -1, FIND_NONE, ""};
+
+void findBufReserve(findBuf* b, int need) {
+    if (need <= b->cap)
+        return;
+    int cap = b->cap ? b->cap * 2 : 256;
+    while (cap < need)
+        cap *= 2;
+    b->m = realloc(b->m, sizeof(findMatch) * cap);
+    if (b->m == NULL)
+        die("realloc");
+    b->cap = cap;
+}
+
+void findBufPush(findBuf* b, int row, int col) {
+    findBufReserve(b, b->len + 1);
+    b->m[b->len].row = row;
+    b->m[b->len].col = col;
+    b->len++;
+}
+
+// Pushes every match of the query in row at, overlapping ones included.
+// Candidates are where both the first and last byte of the query match,
+// tested 16 positions at a time, memcmp only checks those
+void findScanText(findBuf* out, int at, const char* s, int len) {
+    const char* q = F.query;
+    int n = F.qlen;
+    int i = 0;
+
+    if (n == 0 || n > len)
+        return;
+
+#if defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(q[0]);
+    const __m128i last = _mm_set1_epi8(q[n - 1]);
+    for (; i + n - 1 + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)&s[i]);
+        __m128i b = _mm_loadu_si128((const __m128i*)&s[i + n - 1]);
+        unsigned mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            int j = i + __builtin_ctz(mask);
+            if (memcmp(&s[j], q, n) == 0)
+                findBufPush(out, at, j);
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    // Tail, or the whole row without SSE2
+    while (i + n <= len) {
+        const char* p = memchr(&s[i], q[0], len - n + 1 - i);
+        if (p == NULL)
+            break;
+        i = p - s;
+        if (memcmp(p, q, n) == 0)
+            findBufPush(out, at, i);
+        i++;
+    }
+}
+
+// Leftmost longest matches that don't overlap. Empty matches only count on
+// empty rows, so ^$ finds those and a* doesn't match everywhere
+void findScanRegex(findBuf* out, int at, const char* s, int len) {
+    const regex* re = &F.re;
+
+    if (!re->anchor_start && !reSearch(re, s, len))
+        return;
+    if (len == 0) {
+        if (reMatchAt(re, s, 0, 0) == 0)
+            findBufPush(out, at, 0);
+        return;
+    }
+
+    int last = re->anchor_start ? 1 : len;
+    for (int i = 0; i < last;) {
+        int m = reMatchAt(re, s, len, i);
+        if (m > 0) {
+            findBufPush(out, at, i);
+            i += m;
+        } else {
+            i++;
+        }
+    }
+}
+
+// editorRow() for the workers
+erow* findRow(int at) {
+    at -= FP.base;
+    if (at >= FP.rows.gap_start)
+        at += FP.rows.gap_end - FP.rows.gap_start;
+    return &FP.rows.rows[at];
+}
+
+// Runs on the workers, the query and the rows don't change during a job
+void findScanRow(findBuf* out, int at) {
+    erow* row = findRow(at);
+    if (F.regex)
+        findScanRegex(out, at, row->chars, row->size);
+    else
+        findScanText(out, at, row->chars, row->size);
+}
+
+void findWork(int job) {
+    while (__atomic_load_n(&FP.gen, __ATOMIC_RELAXED) == job &&
+           __atomic_load_n(&FP.found, __ATOMIC_RELAXED) < FP.limit) {
+        int c = __atomic_fetch_add(&FP.next_chunk, 1, __ATOMIC_RELAXED);
+        if (c >= FP.nchunks)
+            return;
+
+        findChunk* chunk = &FP.chunks[c];
+        int row = FP.first_row + c * FIND_CHUNK_ROWS;
+        int end = row + FIND_CHUNK_ROWS < FP.numrows ? row + FIND_CHUNK_ROWS
+                                                     : FP.numrows;
+        for (; row < end; row++) {
+            if (__atomic_load_n(&FP.gen, __ATOMIC_RELAXED) != job)
+                return;
+            findScanRow(&chunk->buf, row);
+        }
+        __atomic_add_fetch(&FP.found, chunk->buf.len, __ATOMIC_RELAXED);
+        __atomic_store_n(&chunk->done, 1, __ATOMIC_RELEASE);
+    }
+}
+
+void* findWorker(void* arg) {
+    (void)arg;
+    int seen = 0;
+
+    pthread_mutex_lock(&FP.lock);
+    while (1) {
+        while (FP.job == seen)
+            pthread_cond_wait(&FP.wake, &FP.lock);
+        seen = FP.job;
+        FP.active++;
+        pthread_mutex_unlock(&FP.lock);
+
+        findWork(seen);
+
+        pthread_mutex_lock(&FP.lock);
+        if (--FP.active == 0)
+            pthread_cond_broadcast(&FP.idle);
+    }
+    return NULL;
+}
+
+// One worker per core, they live until the editor exits
+void findPoolInit() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+        n = 1;
+    if (n > FIND_MAX_THREADS)
+        n = FIND_MAX_THREADS;
+    for (int i = 0; i < n; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, findWorker, NULL) != 0)
+            die("pthread_create");
+        pthread_detach(thread);
+    }
+    FP.nthreads = n;
+}
+
+// Cancels the job and waits until no worker is reading rows, has to be called
+// with FP.lock held
+void findPoolCancel() {
+    __atomic_add_fetch(&FP.gen, 1, __ATOMIC_RELAXED);
+    while (FP.active)
+        pthread_cond_wait(&FP.idle, &FP.lock);
+}
+
+void findStop() {
+    pthread_mutex_lock(&FP.lock);
+    findPoolCancel();
+    pthread_mutex_unlock(&FP.lock);
+    F.running = 0;
+}
+
+// Rows a search covers, only the window of a large file. Workers must
+// never make it slide
+int findRowsBegin() { return L->active ? L->first : 0; }
+
+int findRowsEnd() { return L->active ? L->first + L->count : E.buf->numrows; }
+
+// Scans rows first_row and below in the background, their matches are
+// appended to F.hits as they come in
+void findStart(int first_row, int limit) {
+    if (FP.nthreads == 0)
+        findPoolInit();
+
+    pthread_mutex_lock(&FP.lock);
+    findPoolCancel();
+
+    int end = findRowsEnd();
+    if (first_row < findRowsBegin())
+        first_row = findRowsBegin();
+    if (first_row > end)
+        first_row = end;
+    FP.rows = E.buf->rows;
+    FP.base = findRowsBegin();
+    FP.first_row = first_row;
+    FP.numrows = end;
+    FP.nchunks = (end - first_row + FIND_CHUNK_ROWS - 1) / FIND_CHUNK_ROWS;
+    if (FP.nchunks > FP.cap_chunks) {
+        FP.chunks = realloc(FP.chunks, sizeof(findChunk) * FP.nchunks);
+        if (FP.chunks == NULL)
+            die("realloc");
+        memset(&FP.chunks[FP.cap_chunks], 0,
+               sizeof(findChunk) * (FP.nchunks - FP.cap_chunks));
+        FP.cap_chunks = FP.nchunks;
+    }
+    for (int c = 0; c < FP.nchunks; c++) {
+        FP.chunks[c].buf.len = 0;
+        FP.chunks[c].done = 0;
+    }
+    FP.next_chunk = 0;
+    FP.found = 0;
+    FP.limit = limit;
+    FP.job = FP.gen;
+    pthread_cond_broadcast(&FP.wake);
+    pthread_mutex_unlock(&FP.lock);
+
+    F.scanned = first_row;
+    F.merged = 0;
+    F.running = 1;
+}
+
+// Moves the finished chunks at the front of the job into F.hits
+void findDrain() {
+    if (!F.running)
+        return;
+
+    while (F.merged < FP.nchunks &&
+           __atomic_load_n(&FP.chunks[F.merged].done, __ATOMIC_ACQUIRE)) {
+        findBuf* b = &FP.chunks[F.merged].buf;
+        findBufReserve(&F.hits, F.hits.len + b->len);
+        memcpy(&F.hits.m[F.hits.len], b->m, sizeof(findMatch) * b->len);
+        F.hits.len += b->len;
+        F.merged++;
+        F.scanned = FP.first_row + F.merged * FIND_CHUNK_ROWS;
+        if (F.scanned > FP.numrows)
+            F.scanned = FP.numrows;
+    }
+
+    // Done with the file, or the job stopped at its limit and everything
+    // it handed out is in
+    int taken = __atomic_load_n(&FP.next_chunk, __ATOMIC_RELAXED);
+    if (F.merged == FP.nchunks ||
+        (__atomic_load_n(&FP.found, __ATOMIC_RELAXED) >= FP.limit &&
+         F.merged >= taken))
+        F.running = 0;
+}
+
+// Makes query the current one. If it extends the previous one only the
+// previous matches are checked, then the scan continues where it stopped
+void findSetQuery(const char* query, int force) {
+    int n = strlen(query);
+    int extends = F.query && n >= F.qlen && F.qlen > 0 &&
+                  memcmp(query, F.query, F.qlen) == 0;
+
+    if (!force && extends && n == F.qlen)
+        return;
+
+    // Workers read the query and the regex
+    findStop();
+
+    if (n + 1 > F.qcap) {
+        F.qcap = n + 1;
+        F.query = realloc(F.query, F.qcap);
+        if (F.query == NULL)
+            die("realloc");
+    }
+    int old = F.qlen;
+    memcpy(F.query, query, n + 1);
+    F.qlen = n;
+    F.current = -1;
+    F.pending = FIND_FIRST;
+
+    if (F.regex) {
+        reFree(&F.re);
+        F.err = n ? reCompile(&F.re, F.query) : NULL;
+        F.hits.len = 0;
+        F.scanned = findRowsBegin();
+    } else if (extends && !force) {
+        int kept = 0;
+        for (int j = 0; j < F.hits.len; j++) {
+            findMatch m = F.hits.m[j];
+            erow* row = editorRow(m.row);
+            if (m.col + n <= row->size &&
+                memcmp(&row->chars[m.col + old], &query[old], n - old) == 0)
+                F.hits.m[kept++] = m;
+        }
+        F.hits.len = kept;
+    } else {
+        F.hits.len = 0;
+        F.scanned = findRowsBegin();
+    }
+
+    // Nothing to look for, the (empty) matches are complete
+    if (n == 0 || F.err) {
+        F.scanned = findRowsEnd();
+        return;
+    }
+    if (F.scanned < findRowsEnd())
+        findStart(F.scanned, FIND_MAX_MATCHES);
+}
+
+void findJump(int idx) {
+    F.current = idx;
+    E.view->cy = F.hits.m[idx].row;
+    E.view->cx = F.hits.m[idx].col;
+    E.view->rowoff = E.buf->numrows; // Forces scroll to jump to the match
+}
+
+// Moves to the match asked for once it's there. Going past the last match
+// scans what the job left, wrapping around needs the whole file
+void findResolve() {
+    int more = F.running || F.scanned < findRowsEnd();
+
+    switch (F.pending) {
+    case FIND_FIRST:
+        if (F.hits.len)
+            findJump(0);
+        if (F.hits.len || !F.running)
+            F.pending = FIND_NONE;
+        break;
+    case FIND_NEXT:
+        if (F.current + 1 < F.hits.len) {
+            findJump(F.current + 1);
+            F.pending = FIND_NONE;
+        } else if (!more) {
+            if (F.hits.len)
+                findJump(0);
+            F.pending = FIND_NONE;
+        } else if (!F.running) {
+            findStart(F.scanned, FIND_MAX_MATCHES);
+        }
+        break;
+    case FIND_LAST:
+        if (!more) {
+            if (F.hits.len)
+                findJump(F.hits.len - 1);
+            F.pending = FIND_NONE;
+        } else if (!F.running) {
+            findStart(F.scanned, INT_MAX);
+        }
+        break;
+    }
+}
+
+void findUpdatePrompt() {
+    const char* mode = F.regex ? "Regex" : "Search";
+    if (F.regex && F.err)
+        snprintf(F.prompt, sizeof(F.prompt),
+                 "%s: %%s (%s) Tab text | ESC/RETURN", mode, F.err);
+    else
+        snprintf(F.prompt, sizeof(F.prompt),
+                 "%s: %%s [%d%s] Tab %s | ESC/RETURN | ARROWS", mode,
+                 F.hits.len, F.running ? "..." : "",
+                 F.regex ? "text" : "regex");
+}
+
+// Search as you type, the arrows move to the next or previous match and
+// wrap around the file. Matches are found by the pool while keys keep coming,
+// TICK_KEY picks up what it found in the meantime
+void editorFindCallback(char* query, int key) {
+    if (key == '\r' || key == '\x1b') {
+        findStop();
+        return;
+    }
+
+    if (key == '\t') {
+        findStop(); // workers read the mode
+        F.regex = !F.regex;
+        findSetQuery(query, 1);
+    } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
+        F.pending = FIND_NEXT;
+    } else if (key == ARROW_LEFT || key == ARROW_UP) {
+        if (F.current > 0) {
+            findJump(F.current - 1);
+            F.pending = FIND_NONE;
+        } else {
+            F.pending = FIND_LAST;
+        }
+    } else if (key != TICK_KEY) {
+        findSetQuery(query, 0);
+    }
+
+    findDrain();
+    findResolve();
+    findUpdatePrompt();
+}
+
+void editorFind() {
+    int saved_cx = E.view->cx;
+    int saved_cy = E.view->cy;
+    int saved_coloff = E.view->coloff;
+    int saved_rowoff = E.view->rowoff;
+    // Rows may have changed since the last search, start without matches.
+    // The mode stays from the last search
+    F.qlen = 0;
+    F.hits.len = 0;
+    F.scanned = findRowsBegin();
+    F.current = -1;
+    F.pending = FIND_NONE;
+    F.err = NULL;
+    findUpdatePrompt();
+    char* query = editorPrompt(F.prompt, editorFindCallback);
+    if (query) {
+        free(query);
+    } else {
+        E.view->cx = saved_cx;
+        E.view->cy = saved_cy;
+        E.view->coloff = saved_coloff;
+        E.view->rowoff = saved_rowoff;
+    }
+}
+
+/*** large files ***/
+
+// Position in a large buffer: the file offset of a line start and the buffer
+// row there. ov is set once the rows inserted at off (a zero length overlay)
+// were passed
+typedef struct largePos {
+    u64 off;
+    int row;
+    int ov;
+} largePos;
+
+// Index of the overlay starting at off, -1 if there is none
+int largeOverlayAt(u64 off) {
+    int lo = 0, hi = L->nov;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (L->ov[mid].off < off)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < L->nov && L->ov[lo].off == off ? lo : -1;
+}
+
+// Index of the overlay replacing lines that end right before off
+int largeOverlayEndingAt(u64 off) {
+    int lo = 0, hi = L->nov;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (L->ov[mid].off < off)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo > 0 && L->ov[lo - 1].len &&
+        L->ov[lo - 1].off + L->ov[lo - 1].len == off)
+        return lo - 1;
+    return -1;
+}
+
+// Start of the line after the one at off
+u64 largeLineEnd(u64 off) {
+    char* nl = memchr(E.buf->map + off, '\n', E.buf->maplen - off);
+    return nl ? (u64)(nl - E.buf->map) + 1 : E.buf->maplen;
+}
+
+// Moves over the overlay or the line at pos, 0 at the end of the file
+int largeStep(largePos* pos) {
+    int i = pos->ov ? -1 : largeOverlayAt(pos->off);
+    if (i >= 0) {
+        pos->row += L->ov[i].nrows;
+        pos->off += L->ov[i].len;
+        pos->ov = L->ov[i].len == 0;
+        return 1;
+    }
+    if (pos->off >= E.buf->maplen)
+        return 0;
+    pos->off = largeLineEnd(pos->off);
+    pos->row++;
+    pos->ov = 0;
+    return 1;
+}
+
+// Moves back over the overlay or the line before pos, 0 at the start
+int largeStepBack(largePos* pos) {
+    int i;
+    if (pos->ov) {
+        i = largeOverlayAt(pos->off);
+        pos->row -= L->ov[i].nrows;
+        pos->ov = 0;
+        return 1;
+    }
+    if (pos->off == 0)
+        return 0;
+    if ((i = largeOverlayEndingAt(pos->off)) >= 0) {
+        pos->row -= L->ov[i].nrows;
+        pos->off = L->ov[i].off;
+        return 1;
+    }
+    char* nl = memrchr(E.buf->map, '\n', pos->off - 1);
+    pos->off = nl ? (u64)(nl - E.buf->map) + 1 : 0;
+    pos->row--;
+    // Rows inserted before that line come before it
+    pos->ov = largeOverlayAt(pos->off) >= 0;
+    return 1;
+}
+
+// Buffer row of the line that starts at off, -1 if off is inside an overlay
+long long largeRowAtOffset(u64 off, long long line) {
+    long long row = line;
+    for (int i = 0; i < L->nov && L->ov[i].off < off; i++) {
+        if (L->ov[i].off + L->ov[i].len > off)
+            return -1;
+        row += L->ov[i].nrows - L->ov[i].flines;
+    }
+    return row;
+}
+
+// The window in the buffer rows as a parked one, it has to be folded first
+largeWindow largeLive() {
+    return (largeWindow){E.buf->rows, L->lo, L->hi, L->first, L->count,
+                         L->at_eof};
+}
+
+void largeSetLive(largeWindow* w) {
+    E.buf->rows = w->rows;
+    L->lo = w->lo;
+    L->hi = w->hi;
+    L->first = w->first;
+    L->count = w->count;
+    L->at_eof = w->at_eof;
+    L->edited = 0;
+}
+
+// Position of the overlay or line holding buffer row at. Walks from the
+// closest known position: the start of the buffer, the window edges or a
+// mark of the line counter
+largePos largeSeek(int at) {
+    largePos best = {0, 0, 0};
+    for (int i = -1; i < L->npark; i++) {
+        largeWindow w = i < 0 ? largeLive() : L->park[i];
+        if (w.count == 0 && w.hi == 0)
+            continue;
+        largePos lo = {w.lo, w.first, 0};
+        largePos hi = {w.hi, w.first + w.count, largeOverlayAt(w.hi) >= 0};
+        if (abs(lo.row - at) < abs(best.row - at))
+            best = lo;
+        if (abs(hi.row - at) < abs(best.row - at))
+            best = hi;
+    }
+    long long nmarks = __atomic_load_n(&L->nmarks, __ATOMIC_ACQUIRE);
+    long long k = (at - (long long)L->delta) / LARGE_MARK_LINES;
+    for (long long j = k - 1; j <= k + 1; j++) {
+        if (j < 0 || j >= nmarks)
+            continue;
+        long long row = largeRowAtOffset(L->marks[j], j * LARGE_MARK_LINES);
+        if (row >= 0 && llabs(row - at) < abs(best.row - at))
+            best = (largePos){L->marks[j], row, 0};
+    }
+
+    while (best.row > at)
+        largeStepBack(&best);
+    while (1) {
+        largePos next = best;
+        if (!largeStep(&next) || next.row > at)
+            break;
+        best = next;
+    }
+    // A window starts before the rows inserted at its first line
+    if (best.ov)
+        largeStepBack(&best);
+    return best;
+}
+
+// Adds the overlay replacing [off, off + len) with n window rows from slot
+void largeAddOverlay(u64 off, u64 len, int slot, int n) {
+    if (L->nov == L->cap_ov) {
+        L->cap_ov = L->cap_ov ? L->cap_ov * 2 : 16;
+        L->ov = realloc(L->ov, sizeof(largeOverlay) * L->cap_ov);
+        if (L->ov == NULL)
+            die("realloc");
+    }
+    int i = L->nov;
+    while (i > 0 && L->ov[i - 1].off > off) {
+        L->ov[i] = L->ov[i - 1];
+        i--;
+    }
+    largeOverlay* ov = &L->ov[i];
+    ov->off = off;
+    ov->len = len;
+    ov->flines = editorCountNewlines(E.buf->map + off, len);
+    if (len && E.buf->map[off + len - 1] != '\n')
+        ov->flines++;
+    ov->nrows = n;
+    ov->rows = n ? PUSH_ARRAY_NZ(E.buf->arena, erow, n) : NULL;
+    if (n && ov->rows == NULL)
+        die("arena_push");
+    for (int j = 0; j < n; j++) {
+        erow* row = editorRow(L->first + slot + j);
+        ov->rows[j] = *row;
+        ov->rows[j].render = NULL;
+        ov->rows[j].tabs = NULL;
+        ov->rows[j].hl = NULL;
+        ov->rows[j].rsize = 0;
+    }
+    L->nov++;
+}
+
+// Stores the edits of the window as overlays. Rows still pointing into the
+// map are unchanged lines of the file, in file order. Everything between
+// two of them replaces the lines in between, so only edited rows are kept
+void largeFold() {
+    if (!L->edited)
+        return;
+
+    // The window was loaded with the overlays in its range applied
+    int kept = 0;
+    for (int i = 0; i < L->nov; i++) {
+        largeOverlay* ov = &L->ov[i];
+        if (ov->off >= L->lo &&
+            (ov->off < L->hi || (ov->off == L->hi && ov->len == 0)))
+            continue;
+        L->ov[kept++] = *ov;
+    }
+    L->nov = kept;
+
+    u64 pos = L->lo;
+    int gap = 0; // first row after the last file row
+    for (int j = 0; j < L->count; j++) {
+        erow* row = editorRow(L->first + j);
+        if (row->cap)
+            continue;
+        u64 off = row->chars - E.buf->map;
+        if (j > gap || off != pos)
+            largeAddOverlay(pos, off - pos, gap, j - gap);
+        pos = largeLineEnd(off);
+        gap = j + 1;
+    }
+    if (L->count > gap || L->hi != pos)
+        largeAddOverlay(pos, L->hi - pos, gap, L->count - gap);
+    L->edited = 0;
+}
+
+// Fills the window with the rows from pos on, up to buffer row end at least
+// unless the file ends. It never ends right before inserted rows, those
+// belong to the window
+void largeLoad(largePos pos, int end) {
+    E.buf->rows.gap_start = 0;
+    E.buf->rows.gap_end = E.buf->rows.cap;
+    L->lo = pos.off;
+    L->first = pos.row;
+    L->at_eof = 0;
+
+    int n = 0;
+    while (1) {
+        int i = pos.ov ? -1 : largeOverlayAt(pos.off);
+        if (i < 0 && pos.off >= E.buf->maplen) {
+            L->at_eof = 1;
+            break;
+        }
+        if (!pos.ov && i < 0 && L->first + n >= end)
+            break;
+        int add = i >= 0 ? L->ov[i].nrows : 1;
+        while (E.buf->rows.gap_end - E.buf->rows.gap_start < add)
+            editorRowsGrow();
+        if (i >= 0) {
+            memcpy(&E.buf->rows.rows[E.buf->rows.gap_start], L->ov[i].rows,
+                   sizeof(erow) * add);
+        } else {
+            u64 end = largeLineEnd(pos.off);
+            size_t len = end - pos.off;
+            char* p = E.buf->map + pos.off;
+            while (len > 0 && (p[len - 1] == '\n' || p[len - 1] == '\r'))
+                len--;
+            erow* row = &E.buf->rows.rows[E.buf->rows.gap_start];
+            row->size = len;
+            row->cap = 0;
+            row->rsize = 0;
+            row->chars = p;
+            row->render = NULL;
+            row->tabs = NULL;
+            row->hl = NULL;
+            row->hl_state = HLS_UNKNOWN;
+        }
+        E.buf->rows.gap_start += add;
+        n += add;
+        largeStep(&pos);
+    }
+    L->hi = pos.off;
+    L->count = n;
+    L->edited = 0;
+}
+
+// Lets the kernel drop the pages of [lo, hi) that the window doesn't use
+void largeRelease(u64 lo, u64 hi) {
+    u64 page = sysconf(_SC_PAGESIZE);
+    lo = (lo + page - 1) / page * page;
+    hi = hi / page * page;
+    if (lo < hi)
+        madvise(E.buf->map + lo, hi - lo, MADV_DONTNEED);
+}
+
+// Row j of a parked window
+erow* largeParkedRow(largeWindow* w, int j) {
+    if (j >= w->rows.gap_start)
+        j += w->rows.gap_end - w->rows.gap_start;
+    return &w->rows.rows[j];
+}
+
+// Whether a view other than the current one has its cursor in rows
+// [first, first + count]
+int largeViewsIn(int first, int count) {
+    for (int i = 0; i < E.nviews; i++) {
+        struct editorView* v = &E.views[i];
+        if (v != E.view && v->buf == E.buf && v->cy >= first &&
+            v->cy <= first + count)
+            return 1;
+    }
+    return 0;
+}
+
+// Drops the renders of a window that goes away, views drawn from it get an
+// empty render range. Its row array is kept for the next window
+void largeDrop(largeWindow* w) {
+    for (int j = 0; j < w->count; j++)
+        editorRowInvalidate(largeParkedRow(w, j));
+    for (int i = 0; i < E.nviews; i++) {
+        struct editorView* v = &E.views[i];
+        if (v->buf == E.buf && v->render_lo < w->first + w->count &&
+            v->render_hi > w->first)
+            v->render_lo = v->render_hi = w->first;
+    }
+    if (L->nspare < EDITOR_MAX_VIEWS)
+        L->spare[L->nspare++] = w->rows;
+}
+
+// Makes the parked window holding row at the one in the buffer rows, past
+// also takes the row right after a window. 0 if no parked window has it
+int largeSwapTo(int at, int past) {
+    for (int i = 0; i < L->npark; i++) {
+        largeWindow* w = &L->park[i];
+        if (at < w->first || at >= w->first + w->count + past)
+            continue;
+        largeFold();
+        largeWindow live = largeLive();
+        largeSetLive(w);
+        *w = live;
+        return 1;
+    }
+    return 0;
+}
+
+// The window in the buffer rows got a row more (dir 1) or less (dir -1),
+// the parked windows after it move with their rows
+void largeShiftParked(int dir) {
+    for (int i = 0; i < L->npark; i++) {
+        if (L->park[i].first > L->first)
+            L->park[i].first += dir;
+    }
+}
+
+// Moves the window so it is centered on buffer row at. Another view keeps
+// the window its cursor is in, parked, unless it is close enough for this
+// one to take in its rows too. Views far apart in the file never make each
+// other slide
+void largeWindowAt(int at) {
+    largeFold();
+
+    int lo = at - LARGE_WINDOW_ROWS / 2;
+    int hi = at + LARGE_WINDOW_ROWS / 2;
+    for (int grown = 1; grown;) {
+        grown = 0;
+        for (int i = 0; i < E.nviews; i++) {
+            struct editorView* v = &E.views[i];
+            int vlo = v->cy - LARGE_WINDOW_ROWS / 2;
+            int vhi = v->cy + LARGE_WINDOW_ROWS / 2;
+            if (v == E.view || v->buf != E.buf || vlo > hi || vhi < lo ||
+                (vlo >= lo && vhi <= hi))
+                continue;
+            lo = vlo < lo ? vlo : lo;
+            hi = vhi > hi ? vhi : hi;
+            grown = 1;
+        }
+    }
+    if (lo < 0)
+        lo = 0;
+
+    // Windows other views still need stay if they don't overlap the new one
+    int kept = 0;
+    for (int i = 0; i < L->npark; i++) {
+        largeWindow* w = &L->park[i];
+        if (largeViewsIn(w->first, w->count) &&
+            (w->first > hi || w->first + w->count < lo))
+            L->park[kept++] = *w;
+        else
+            largeDrop(w);
+    }
+    L->npark = kept;
+    largeWindow live = largeLive();
+    if (largeViewsIn(live.first, live.count) &&
+        (live.first > hi || live.first + live.count < lo))
+        L->park[L->npark++] = live;
+    else
+        largeDrop(&live);
+
+    rowbuf rb = {NULL, 0, 0, 0};
+    if (L->nspare) {
+        rb = L->spare[--L->nspare];
+    } else {
+        rb.rows = PUSH_ARRAY_NZ(E.buf->arena, erow, LARGE_WINDOW_ROWS * 2);
+        if (rb.rows == NULL)
+            die("arena_push");
+        rb.cap = LARGE_WINDOW_ROWS * 2;
+    }
+    // Workers only read rows of the window they were started on
+    if (rb.rows == FP.rows.rows)
+        findStop();
+
+    u64 old_lo = live.lo, old_hi = live.hi;
+    largePos pos = largeSeek(lo);
+    E.buf->rows = rb;
+    largeLoad(pos, hi);
+
+    // A parked window may only touch this one in the file, they can't share
+    // the rows inserted where they meet
+    kept = 0;
+    for (int i = 0; i < L->npark; i++) {
+        largeWindow* w = &L->park[i];
+        if (w->lo <= L->hi && L->lo <= w->hi)
+            largeDrop(w);
+        else
+            L->park[kept++] = *w;
+    }
+    L->npark = kept;
 
-// Converts index of characters into index of rendered characters (tab expanded)
-int editorRowCxToRx(erow* row, int cx) {
-    int rx = 0;
-    int j;
-    for (j = 0; j < cx; j++) {
-        if (row->chars[j] == '\t') {
-            rx += (KILO_TAB_STOP - 1) - (rx % KILO_TAB_STOP);
+    // Pages no window uses anymore
+    if (!largeViewsIn(live.first, live.count)) {
+        largeRelease(old_lo, old_hi < L->lo ? old_hi : L->lo);
+        largeRelease(old_lo > L->hi ? old_lo : L->hi, old_hi);
+    }
+    if (at < L->first || at > L->first + L->count)
+        die("largeWindowAt");
+}
+
+// Counts the lines of the file of buffer arg with its own descriptor and
+// chunk buffer, so the pages it reads never end up in the editor
+void* largeCount(void* arg) {
+    struct editorBuffer* b = arg;
+    struct largeFile* l = &b->large;
+    char* buf = malloc(LARGE_COUNT_CHUNK);
+    if (buf == NULL)
+        return NULL;
+    u64 off = 0;
+    long long lines = 0;
+    long long nmarks = 1; // line 0 starts at 0
+    char last = '\n';
+
+    while (!__atomic_load_n(&l->stop, __ATOMIC_RELAXED)) {
+        ssize_t n = pread(l->fd, buf, LARGE_COUNT_CHUNK, off);
+        if (n <= 0)
+            break;
+        long long c = editorCountNewlines(buf, n);
+        // Lines starting in this chunk that get a mark
+        long long next = nmarks * LARGE_MARK_LINES;
+        if (lines + c >= next) {
+            long long seen = lines;
+            for (char* p = buf; (p = memchr(p, '\n', buf + n - p)); p++) {
+                if (++seen == next) {
+                    l->marks[nmarks++] = off + (p - buf) + 1;
+                    next += LARGE_MARK_LINES;
+                }
+            }
+            __atomic_store_n(&l->nmarks, nmarks, __ATOMIC_RELEASE);
         }
-        rx++;
+        posix_fadvise(l->fd, off, n, POSIX_FADV_DONTNEED);
+        off += n;
+        lines += c;
+        last = buf[n - 1];
+        __atomic_store_n(&l->count_lines, lines, __ATOMIC_RELAXED);
+        __atomic_store_n(&l->count_bytes, off, __ATOMIC_RELAXED);
     }
-    return rx;
+    if (off == b->maplen) {
+        // A last line without '\n'
+        if (last != '\n')
+            __atomic_store_n(&l->count_lines, lines + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&l->count_done, 1, __ATOMIC_RELEASE);
+    }
+    free(buf);
+    return NULL;
 }
 
-// Converts index of rendered characters (tab expanded) into index of characters
-int editorRowRxToCs(erow* row, int rx) {
-    int cur_rx = 0;
-    int cx;
-    for (cx = 0; cx < row->size; cx++) {
-        if (row->chars[cx] == '\t')
-            cur_rx += (KILO_TAB_STOP - 1) - (cur_rx % KILO_TAB_STOP);
-        cur_rx++;
+// Opens the mapped file windowed, fd is the file E.buf->map came from
+void largeOpen(int fd) {
+    L->active = 1;
+    E.buf->syntax = NULL;
+
+    // Until the counter has something, guess from the first MiB
+    size_t sample = E.buf->maplen < MiB(1) ? E.buf->maplen : MiB(1);
+    size_t nl = editorCountNewlines(E.buf->map, sample);
+    L->file_lines = nl ? (long long)((double)E.buf->maplen / sample * nl) : 1;
+    // Saving writes rows that were edited with the file's own terminator,
+    // the unchanged ranges keep theirs
+    char* eol = memchr(E.buf->map, '\n', E.buf->maplen);
+    L->crlf = eol && eol > E.buf->map && eol[-1] == '\r';
+
+    L->fd = dup(fd);
+    L->marks = malloc(sizeof(u64) * (E.buf->maplen / LARGE_MARK_LINES + 2));
+    if (L->fd == -1 || L->marks == NULL)
+        die("largeOpen");
+    L->marks[0] = 0;
+    L->nmarks = 1;
+    if (pthread_create(&L->thread, NULL, largeCount, E.buf) != 0)
+        die("pthread_create");
+
+    E.buf->rows.rows = PUSH_ARRAY_NZ(E.buf->arena, erow, LARGE_WINDOW_ROWS * 2);
+    if (E.buf->rows.rows == NULL)
+        die("arena_push");
+    E.buf->rows.cap = LARGE_WINDOW_ROWS * 2;
+    largeLoad((largePos){0, 0, 0}, LARGE_WINDOW_ROWS);
+    E.buf->numrows = L->count;
+}
+
+void largeClose() {
+    if (!L->active)
+        return;
+    __atomic_store_n(&L->stop, 1, __ATOMIC_RELAXED);
+    pthread_join(L->thread, NULL);
+    close(L->fd);
+    free(L->marks);
+    free(L->ov);
+    memset(L, 0, sizeof(*L));
+}
 
-        if (cur_rx > rx)
-            return cx;
+// Brings E.buf->numrows up to date with the counter and the window
+void largeRefresh() {
+    if (!L->exact) {
+        if (__atomic_load_n(&L->count_done, __ATOMIC_ACQUIRE)) {
+            L->file_lines = __atomic_load_n(&L->count_lines, __ATOMIC_RELAXED);
+            L->exact = 1;
+        } else {
+            u64 bytes = __atomic_load_n(&L->count_bytes, __ATOMIC_RELAXED);
+            long long lines =
+                __atomic_load_n(&L->count_lines, __ATOMIC_RELAXED);
+            if (bytes && lines)
+                L->file_lines =
+                    lines + (long long)((double)(E.buf->maplen - bytes) /
+                                        bytes * lines);
+        }
+    }
+    // Rows the windows hold exist, a window that saw the end knows there
+    // are none past it
+    int end = 0, eof = 0;
+    for (int i = -1; i < L->npark; i++) {
+        largeWindow w = i < 0 ? largeLive() : L->park[i];
+        if (w.first + w.count > end)
+            end = w.first + w.count;
+        if (w.at_eof) {
+            L->file_lines = w.first + w.count - L->delta;
+            L->exact = 1;
+            eof = 1;
+        }
     }
-    return cx;
+    long long rows = L->file_lines + L->delta;
+    if (!eof && rows <= end)
+        rows = end + 1;
+    if (rows > INT_MAX / 2)
+        rows = INT_MAX / 2;
+    E.buf->numrows = rows;
 }
 
-void editorUpdateRow(erow* row) {
-    int tabs = 0;
-    int j;
+// Whether the window holds margin rows on both sides of row at, or the file
+// ends before
+int largeCovers(int at, int margin) {
+    return (at - margin >= L->first || L->first == 0) &&
+           (at + margin < L->first + L->count || L->at_eof);
+}
 
-    for (j = 0; j < row->size; j++) {
-        if (row->chars[j] == '\t')
-            tabs++;
+// Called before the cursor is used, keeps LARGE_MARGIN rows around it loaded
+// so moving and drawing never slide the window halfway
+void largeSync() {
+    if (!L->active)
+        return;
+    int margin = E.screenrows * 2 > LARGE_MARGIN ? E.screenrows * 2
+                                                  : LARGE_MARGIN;
+    if (!largeCovers(E.view->cy, margin))
+        largeSwapTo(E.view->cy, 1);
+    largeRefresh();
+    if (E.view->cy > E.buf->numrows)
+        E.view->cy = E.buf->numrows;
+    if (!largeCovers(E.view->cy, margin)) {
+        largeWindowAt(E.view->cy);
+        largeRefresh();
+        if (E.view->cy > E.buf->numrows)
+            E.view->cy = E.buf->numrows;
     }
+}
 
-    free(row->render);
-    row->render = malloc(row->size + tabs * (KILO_TAB_STOP - 1) + 1);
+// Terminator of the rows a large file gets written with, see largeOpen()
+#define LARGE_EOL ((char*)"\r\n" + !L->crlf)
+#define LARGE_EOL_LEN (1 + L->crlf)
+
+// Writes the rows of an overlay, n at most SAVE_BATCH_ROWS at a time
+int largeWriteOverlay(int fd, largeOverlay* ov) {
+    struct iovec iov[SAVE_BATCH_ROWS * 2];
+    int cnt = 0;
+    for (int j = 0; j < ov->nrows; j++) {
+        iov[cnt].iov_base = ov->rows[j].chars;
+        iov[cnt].iov_len = ov->rows[j].size;
+        iov[cnt + 1].iov_base = LARGE_EOL;
+        iov[cnt + 1].iov_len = LARGE_EOL_LEN;
+        cnt += 2;
+        if (cnt == SAVE_BATCH_ROWS * 2 || j == ov->nrows - 1) {
+            if (editorWritev(fd, iov, cnt) == -1)
+                return -1;
+            cnt = 0;
+        }
+    }
+    return 0;
+}
 
-    int idx = 0;
+// Streams the file with the overlays applied, the unchanged ranges go
+// straight from the mapping
+long long largeWriteRows(int fd) {
+    largeFold();
+    long long total = 0;
+    u64 pos = 0;
+    for (int i = 0; i <= L->nov; i++) {
+        u64 end = i < L->nov ? L->ov[i].off : E.buf->maplen;
+        struct iovec iov = {E.buf->map + pos, end - pos};
+        if (end > pos && editorWritev(fd, &iov, 1) == -1)
+            return -1;
+        total += end - pos;
+        if (i == L->nov) {
+            // Every row ends with a terminator, like editorWriteRows()
+            if (end > pos && E.buf->map[end - 1] != '\n') {
+                struct iovec nl = {LARGE_EOL, LARGE_EOL_LEN};
+                if (editorWritev(fd, &nl, 1) == -1)
+                    return -1;
+                total += LARGE_EOL_LEN;
+            }
+            break;
+        }
 
-    for (j = 0; j < row->size; j++) {
-        if (row->chars[j] == '\t') {
-            row->render[idx++] = ' ';
-            while (idx % KILO_TAB_STOP != 0)
-                row->render[idx++] = ' ';
-        } else {
-            row->render[idx++] = row->chars[j];
+        largeOverlay* ov = &L->ov[i];
+        // Rows appended to a file without a last '\n'
+        if (ov->off == E.buf->maplen && E.buf->maplen &&
+            E.buf->map[E.buf->maplen - 1] != '\n') {
+            struct iovec nl = {LARGE_EOL, LARGE_EOL_LEN};
+            if (editorWritev(fd, &nl, 1) == -1)
+                return -1;
+            total += LARGE_EOL_LEN;
         }
+        if (largeWriteOverlay(fd, ov) == -1)
+            return -1;
+        for (int j = 0; j < ov->nrows; j++)
+            total += ov->rows[j].size + LARGE_EOL_LEN;
+        pos = ov->off + ov->len;
     }
-
-    row->render[idx] = '\0';
-    row->rsize = idx;
+    return total;
 }
 
-void editorInsertRow(int at, char* s, size_t len) {
-    if (at < 0 || at > E.numrows)
-        return;
+/*** append buffer ***/
+
+// Append buffer for efficient screen rendering
+struct abuf {
+    char* b; // Pointer to the dynamically allocated buffer
+    int len; // length of the string in the buffer
+    int cap; // allocated bytes of b
+};
 
-    E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
-    memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
+#define ABUF_INIT {NULL, 0, 0}
 
-    E.row[at].size = len;
-    E.row[at].chars = malloc(len + 1);
-    memcpy(E.row[at].chars, s, len);
-    E.row[at].chars[len] = '\0';
+// Appends, bytes and reallocs of every abuf, reported by --bench-frames
+long ab_appends = 0;
+long ab_bytes = 0;
+long ab_grows = 0;
 
-    E.row[at].rsize = 0;
-    E.row[at].render = NULL;
+// Function to append into a string
+// Takes an append buffer (pointer to string and length)
+// The new string to be appended
+// The size of the strings to be appended
+void abApppend(struct abuf* ab, const char* s, int len) {
+    ab_appends++;
+    ab_bytes += len;
+    // Only reallocate when it doesn't fit, doubling so a frame needs a
+    // handful of reallocs at most
+    if (ab->len + len > ab->cap) {
+        int cap = ab->cap ? ab->cap * 2 : 1024;
+        while (cap < ab->len + len)
+            cap *= 2;
+        char* new = realloc(ab->b, cap);
+
+        // If the reallocation fails, finish the function
+        if (new == NULL)
+            return;
 
-    editorUpdateRow(&E.row[at]);
+        ab->b = new;
+        ab->cap = cap;
+        ab_grows++;
+    }
 
-    E.numrows++;
-    E.dirty++;
+    // We copy the passed string after the old string
+    memcpy(&ab->b[ab->len], s, len);
+    // Update the length of the string
+    ab->len += len;
 }
 
-void editorFreeRow(erow* row) {
-    free(row->render);
-    free(row->chars);
+// Empties the buffer but keeps its memory for the next frame
+void abReset(struct abuf* ab) {
+    ab->len = 0;
 }
 
-void editorDelRow(int at) {
-    if (at < 0 || at >= E.numrows)
-        return;
-    editorFreeRow(&E.row[at]);
-    memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
-    E.numrows--;
-    E.dirty++;
+void abFree(struct abuf* ab) {
+    free(ab->b);
 }
 
-void editorRowInsertChar(erow* row, int at, int c) {
-    if (at < 0 || at > row->size)
-        at = row->size;
-    row->chars = realloc(row->chars, row->size + 2);
-    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-    row->size++;
-    row->chars[at] = c;
-    editorUpdateRow(row);
-    E.dirty++;
+/*** screen ***/
+
+void screenInit(screen* sc, int rows, int cols) {
+    sc->rows = rows;
+    sc->cols = cols;
+    sc->chars = malloc(rows * cols);
+    sc->attrs = malloc(rows * cols);
+    sc->lens = calloc(rows, sizeof(int));
+    if (sc->chars == NULL || sc->attrs == NULL || sc->lens == NULL)
+        die("malloc");
 }
 
-void editorRowAppendString(erow* row, char* s, size_t len) {
-    row->chars = realloc(row->chars, row->size + len + 1);
-    memcpy(&row->chars[row->size], s, len);
-    row->size += len;
-    row->chars[row->size] = '\0';
-    editorUpdateRow(row);
-    E.dirty++;
+void screenClearLine(screen* sc, int y) {
+    sc->lens[y] = 0;
 }
 
-void editorRowDelChar(erow* row, int at) {
-    if (at < 0 || at >= row->size)
+// Appends len cells to line y, whatever doesn't fit is cut off
+void screenPut(screen* sc, int y, const char* s, int len,
+               unsigned char attr) {
+    int x = sc->lens[y];
+    if (len > sc->cols - x)
+        len = sc->cols - x;
+    if (len <= 0)
         return;
-    memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-    row->size--;
-    editorUpdateRow(row);
-    E.dirty++;
+    memcpy(&sc->chars[y * sc->cols + x], s, len);
+    memset(&sc->attrs[y * sc->cols + x], attr, len);
+    sc->lens[y] = x + len;
 }
 
-/*** editor operations ***/
-void editorInsertChar(int c) {
-    if (E.cy == E.numrows) {
-        editorInsertRow(E.numrows, "", 0);
-    }
-    editorRowInsertChar(&E.row[E.cy], E.cx, c);
-    E.cx++;
+void screenFill(screen* sc, int y, char c, int len, unsigned char attr) {
+    int x = sc->lens[y];
+    if (len > sc->cols - x)
+        len = sc->cols - x;
+    if (len <= 0)
+        return;
+    memset(&sc->chars[y * sc->cols + x], c, len);
+    memset(&sc->attrs[y * sc->cols + x], attr, len);
+    sc->lens[y] = x + len;
 }
 
-void editorInsertNewline() {
-    if (E.cx == 0) {
-        editorInsertRow(E.cy, "", 0);
-    } else {
-        erow* row = &E.row[E.cy];
-        editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
-        row = &E.row[E.cy];
-        row->size = E.cx;
-        row->chars[row->size] = '\0';
-        editorUpdateRow(row);
-    }
-    E.cy++;
-    E.cx = 0;
+int screenLineEq(screen* a, int ya, screen* b, int yb) {
+    int len = a->lens[ya];
+    return len == b->lens[yb] &&
+           memcmp(&a->chars[ya * a->cols], &b->chars[yb * b->cols], len) == 0 &&
+           memcmp(&a->attrs[ya * a->cols], &b->attrs[yb * b->cols], len) == 0;
 }
 
-void editorDelChar() {
-    if (E.cy == E.numrows)
-        return;
-    if (E.cx == 0 && E.cy == 0)
-        return;
-
-    erow* row = &E.row[E.cy];
-    if (E.cx > 0) {
-        editorRowDelChar(row, E.cx - 1);
-        E.cx--;
-    } else {
-        E.cx = E.row[E.cy - 1].size;
-        editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
-        editorDelRow(E.cy);
-        E.cy--;
+// Lines of the text area from y0 down that would already be right if the
+// terminal scrolled them up by d (down when negative)
+int screenShiftScore(int y0, int d) {
+    int score = 0;
+    for (int y = y0; y < E.screenrows; y++) {
+        int from = y + d;
+        if (from >= y0 && from < E.screenrows &&
+            screenLineEq(&E.back, y, &E.front, from))
+            score++;
     }
+    return score;
 }
 
-/*** file i/o ***/
-
-char* editorRowsToString(int* buflen) {
-    int totlen = 0;
-    int j;
-    for (j = 0; j < E.numrows; j++) {
-        totlen += E.row[j].size + 1;
-    }
-    *buflen = totlen;
+// Moves lines y0 and below of the text area by d in the model of the
+// terminal, the lines that come in are blank
+void screenShiftFront(int y0, int d) {
+    screen* f = &E.front;
+    int n = E.screenrows - y0 - (d > 0 ? d : -d);
+    int from = d > 0 ? y0 + d : y0;
+    int to = d > 0 ? y0 : y0 - d;
+    int blank = d > 0 ? y0 + n : y0;
+
+    memmove(&f->chars[to * f->cols], &f->chars[from * f->cols], n * f->cols);
+    memmove(&f->attrs[to * f->cols], &f->attrs[from * f->cols], n * f->cols);
+    memmove(&f->lens[to], &f->lens[from], n * sizeof(int));
+    for (int y = blank; y < blank + E.screenrows - y0 - n; y++)
+        f->lens[y] = 0;
+}
 
-    // To mantain original reference to start of buffer
-    char* buf = malloc(totlen);
-    // To traverse and write the buffer
-    char* p = buf;
+// When rows were scrolled, inserted or deleted the terminal moves the lines
+// inside a scroll region instead of getting them written again
+void screenScroll(struct abuf* ab) {
+    int y0 = 0;
+    while (y0 < E.screenrows && screenLineEq(&E.back, y0, &E.front, y0))
+        y0++;
+    if (y0 >= E.screenrows - 1)
+        return;
 
-    for (j = 0; j < E.numrows; j++) {
-        memcpy(p, E.row[j].chars, E.row[j].size);
-        p += E.row[j].size;
-        *p = '\n';
-        p++;
+    // Candidates: the scroll offset change and a single inserted or deleted
+    // row
+    int cand[3] = {E.view->rowoff - E.front_rowoff, 1, -1};
+    int best = 0;
+    int best_score = screenShiftScore(y0, 0) + 1;
+    for (int i = 0; i < 3; i++) {
+        int d = cand[i];
+        if (d == 0 || d >= E.screenrows - y0 || -d >= E.screenrows - y0)
+            continue;
+        int score = screenShiftScore(y0, d);
+        if (score > best_score) {
+            best = d;
+            best_score = score;
+        }
     }
+    if (best == 0)
+        return;
 
-    return buf;
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dr\x1b[%d%c", y0 + 1,
+                       E.screenrows, best > 0 ? best : -best,
+                       best > 0 ? 'S' : 'T');
+    abApppend(ab, buf, len);
+    // Resetting the region moves the cursor home, every write positions it
+    abApppend(ab, "\x1b[r", 3);
+    screenShiftFront(y0, best);
 }
 
-void editorOpen(char* filename) {
-    // Open file read mode
-    free(E.filename);
-    E.filename = strdup(filename);
-
-    FILE* fp = fopen(filename, "r");
-    if (!fp)
-        die("fopen");
-
-    char* line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
-
-    // While getting a line from the file and storing length and content doesnt
-    // fail
-    while ((linelen = getline(&line, &linecap, fp)) != -1) {
-        // While it has text, it has a \n or \r at the end
-        while (linelen > 0 &&
-               (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
-            linelen--;
-        // Append string without the \n or \r
-        editorInsertRow(E.numrows, line, linelen);
+const char* editorScreenAttr(unsigned char attr) {
+    switch (attr) {
+    case ATTR_INVERSE:
+        return "\x1b[7m";
+    case ATTR_COMMENT:
+        return "\x1b[0;36m";
+    case ATTR_KEYWORD1:
+        return "\x1b[0;33m";
+    case ATTR_KEYWORD2:
+        return "\x1b[0;32m";
+    case ATTR_STRING:
+        return "\x1b[0;35m";
+    case ATTR_NUMBER:
+        return "\x1b[0;31m";
+    default:
+        return "\x1b[m";
     }
-    free(line);
-    fclose(fp);
-    E.dirty = 0;
 }
 
-void editorSave() {
-    if (E.filename == NULL) {
-        E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
-        if (E.filename == NULL) {
-            editorSetStatusMessage("Save aborted");
-        }
+// Rewrites the changed span of line y, from the first to the last cell that
+// differs. The blank past the end of a line is cleared with \x1b[K
+void screenFlushLine(struct abuf* ab, int y) {
+    screen* b = &E.back;
+    screen* f = &E.front;
+    char* bc = &b->chars[y * b->cols];
+    char* fc = &f->chars[y * f->cols];
+    unsigned char* ba = &b->attrs[y * b->cols];
+    unsigned char* fa = &f->attrs[y * f->cols];
+    int blen = b->lens[y];
+    int flen = f->lens[y];
+    int common = blen < flen ? blen : flen;
+
+    int x0 = 0;
+    while (x0 < common && bc[x0] == fc[x0] && ba[x0] == fa[x0])
+        x0++;
+    if (x0 == common && blen == flen)
         return;
-    }
 
-    int len;
-    char* buf = editorRowsToString(&len);
+    // Last differing cell inside the new line, everything past it that was
+    // already there stays
+    int x1 = blen;
+    if (blen == flen) {
+        while (x1 > x0 && bc[x1 - 1] == fc[x1 - 1] && ba[x1 - 1] == fa[x1 - 1])
+            x1--;
+    }
 
-    int fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-    if (fd != -1) {
-        if (ftruncate(fd, len) != -1) {
-            if (write(fd, buf, len) == len) {
-                close(fd);
-                free(buf);
-                E.dirty = 0;
-                editorSetStatusMessage("%d bytes written to disk", len);
-                return;
-            }
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, x0 + 1);
+    abApppend(ab, buf, len);
+
+    unsigned char cur = ATTR_NORMAL;
+    int x = x0;
+    while (x < x1) {
+        // Runs of cells with the same attribute
+        int run = x;
+        while (run < x1 && ba[run] == ba[x])
+            run++;
+        if (ba[x] != cur) {
+            const char* seq = editorScreenAttr(ba[x]);
+            abApppend(ab, seq, strlen(seq));
+            cur = ba[x];
         }
-        close(fd);
+        abApppend(ab, &bc[x], run - x);
+        x = run;
     }
-    free(buf);
-    editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+    if (cur != ATTR_NORMAL)
+        abApppend(ab, "\x1b[m", 3);
+
+    if (flen > blen)
+        abApppend(ab, "\x1b[K", 3); // Clears the line from cursor to end
 }
 
-/*** find ***/
+// Writes the difference between the drawn frame and the terminal, then the
+// drawn frame becomes the front one
+void screenFlush(struct abuf* ab) {
+    if (!E.front_valid) {
+        // Nothing is known about the terminal, start from a blank one
+        abApppend(ab, "\x1b[m\x1b[2J", 7);
+        for (int y = 0; y < E.front.rows; y++)
+            E.front.lens[y] = 0;
+        E.front_valid = 1;
+    } else if (E.nviews == 1) {
+        // Lines of several views don't move together
+        screenScroll(ab);
+    }
 
-// Finds a substring and sets the cursor to it from the top down (skips
-// subsecuent matches on the same line)
+    for (int y = 0; y < E.back.rows; y++)
+        screenFlushLine(ab, y);
 
-void editorFindCallback(char* query, int key) {
-    // Later on will implement matches on the same row
-    // For this im thinking on an array that finds the index of all matches and
-    // is stored on a static variable until we go to the next row
+    screen tmp = E.front;
+    E.front = E.back;
+    E.back = tmp;
+    E.front_rowoff = E.view->rowoff;
+}
 
-    // Need to analyze the logic behind trying to move the cursor and keep track
-    // of next and previous positions of the matches
-    // we will have the array of indexes of matches on a row, so lets
+/*** views ***/
 
-    static int last_match_row = -1;
-    static int last_match_idx = -1;
-    static int direction = 1;
+// Makes v the view keys go to, E.buf and L follow it
+void editorSetView(struct editorView* v) {
+    E.view = v;
+    E.buf = v->buf;
+    L = &v->buf->large;
+    // The window around its cursor, searches only cover that one
+    if (L->active && (v->cy < L->first || v->cy >= L->first + L->count))
+        largeSwapTo(v->cy, 1);
+}
 
-    if (key == '\r' || key == '\x1b') {
-        last_match_row = -1;
-        last_match_idx = -1;
-        direction = 1;
-        return;
-    } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
-        direction = 1;
-    } else if (key == ARROW_LEFT || key == ARROW_UP) {
-        direction = -1;
-    } else {
-        // Reset state when ESC or other char
-        last_match_row = 1;
-        last_match_idx = 1;
-        direction = -1;
-    }
-
-    // For starting a new search
-    int current = last_match_row;
-    if (current == -1)
-        current = (direction == 1) ? 0 : E.numrows - 1;
-
-    for (int i = 0; i <= E.numrows; i++) {
-        erow* row = &E.row[current];
-        int* matches = row_substr(row->render, query);
-
-        if (matches && matches[0] != -1) {
-            // matches on row
-            int num_matches = 0;
-            while (matches[num_matches] != -1)
-                num_matches++;
-
-            int next_idx = -1;
-
-            if (current == last_match_row && i == 0) {
-                // We are trying to navigate horizontally on the same row
-                next_idx = last_match_idx + direction;
-                // If we go out of bounds, we flag it as -1 to jump to the next
-                // row
-                if (next_idx < 0 || next_idx >= num_matches) {
-                    next_idx = -1;
-                }
-            } else {
-                // We have landed on a new row (or wrapped back to the original
-                // row). Pick the first or last match depending on our search
-                // direction.
-                next_idx = (direction == 1) ? 0 : (num_matches - 1);
-            }
+// An empty buffer, it stays open until the editor exits
+struct editorBuffer* editorNewBuffer() {
+    struct editorBuffer* b = calloc(1, sizeof(*b));
+    E.bufs = realloc(E.bufs, sizeof(*E.bufs) * (E.nbufs + 1));
+    if (b == NULL || E.bufs == NULL)
+        die("malloc");
+    b->arena = arena_create(GiB(16), MiB(1));
+    b->undo = arena_create(GiB(4), KiB(64));
+    if (b->arena == NULL || b->undo == NULL)
+        die("arena_create");
+    E.bufs[E.nbufs++] = b;
+    return b;
+}
 
-            if (next_idx != -1) {
-                // We found a valid target! Update our state and cursor.
-                last_match_row = current;
-                last_match_idx = next_idx;
+// The buffer filename is open in, by path when the file exists
+struct editorBuffer* editorFindBuffer(const char* filename) {
+    char* path = realpath(filename, NULL);
+    struct editorBuffer* found = NULL;
+    for (int i = 0; i < E.nbufs && found == NULL; i++) {
+        char* name = E.bufs[i]->filename;
+        if (name == NULL)
+            continue;
+        char* p = path ? realpath(name, NULL) : NULL;
+        if (p ? strcmp(p, path) == 0 : strcmp(name, filename) == 0)
+            found = E.bufs[i];
+        free(p);
+    }
+    free(path);
+    return found;
+}
 
-                E.cy = current;
-                E.cx = editorRowRxToCs(row, matches[next_idx]);
-                E.rowoff = E.numrows; // Forces scroll to jump to the match
+// Splits the text area in columns of the same width, a bar between them
+void editorLayoutViews() {
+    int w = (E.screencols - (E.nviews - 1)) / E.nviews;
+    for (int i = 0; i < E.nviews; i++) {
+        E.views[i].left = i * (w + 1);
+        E.views[i].cols = w;
+    }
+    // The last one takes what the division left over
+    E.views[E.nviews - 1].cols = E.screencols - E.views[E.nviews - 1].left;
+}
 
-                free(matches); // Prevent memory leaks
-                return;
-            }
-        }
+// Starts line y of the current view, the views left of it are drawn already
+void editorViewLine(int y) {
+    if (E.view->left == 0) {
+        screenClearLine(&E.back, y);
+        return;
+    }
+    screenFill(&E.back, y, ' ', E.view->left - 1 - E.back.lens[y],
+               ATTR_NORMAL);
+    screenPut(&E.back, y, "|", 1, ATTR_NORMAL);
+}
 
-        free(matches); // Free array if we found matches but exhausted them
+// Keeps the cursor of a view that was not the current one inside the text,
+// edits made in other views may have shortened its rows meanwhile
+void editorClampCursor() {
+    if (E.view->cy > E.buf->numrows)
+        E.view->cy = E.buf->numrows;
+    int size = E.view->cy < E.buf->numrows ? editorRow(E.view->cy)->size : 0;
+    if (E.view->cx > size)
+        E.view->cx = size;
+}
 
-        // Navigate to the next row and wrap around if necessary
-        current += direction;
-        if (current < 0)
-            current = E.numrows - 1;
-        else if (current >= E.numrows)
-            current = 0;
-    }
+// Moves the cursor to view i
+void editorFocusView(int i) {
+    editorSetView(&E.views[i]);
+    editorClampCursor();
 }
 
-void editorFind() {
-    int saved_cx = E.cx;
-    int saved_cy = E.cy;
-    int saved_coloff = E.coloff;
-    int saved_rowoff = E.rowoff;
-    char* query =
-        editorPrompt("Search: %s (ESC/RETURN cancel | ARROWS find more)",
-                     editorFindCallback);
-    if (query) {
-        free(query);
-    } else {
-        E.cx = saved_cx;
-        E.cy = saved_cy;
-        E.coloff = saved_coloff;
-        E.rowoff = saved_rowoff;
+// Shows the buffer of the current view a second time, right of it and with
+// the same cursor. Both views share the rows and their renders
+void editorSplitView() {
+    if (E.nviews == EDITOR_MAX_VIEWS ||
+        (E.screencols - E.nviews) / (E.nviews + 1) < 10) {
+        editorSetStatusMessage("No room for another view");
+        return;
     }
+    int at = E.view - E.views + 1;
+    memmove(&E.views[at + 1], &E.views[at],
+            sizeof(struct editorView) * (E.nviews - at));
+    E.views[at] = E.views[at - 1];
+    E.nviews++;
+    editorLayoutViews();
+    editorFocusView(at);
 }
 
-/*** append buffer ***/
-
-// Append buffer for efficient screen rendering
-struct abuf {
-    char* b; // Pointer to the dynamically allocated buffer
-    int len; // length of the string in the buffer
-};
+// Closes the current view, its buffer stays open
+void editorCloseView() {
+    if (E.nviews == 1)
+        return;
+    editorRowsKeepRenders(0, 0);
+    int at = E.view - E.views;
+    memmove(&E.views[at], &E.views[at + 1],
+            sizeof(struct editorView) * (E.nviews - at - 1));
+    E.nviews--;
+    editorLayoutViews();
+    editorFocusView(at < E.nviews ? at : E.nviews - 1);
+}
 
-#define ABUF_INIT {NULL, 0}
+// Shows b in the current view, where another view of it is or from the top
+void editorShowBuffer(struct editorBuffer* b) {
+    editorRowsKeepRenders(0, 0);
+    struct editorView v = {b, 0, 0, 0, 0, 0, E.view->left, E.view->cols, 0, 0};
+    for (int i = 0; i < E.nviews; i++) {
+        if (E.views[i].buf == b) {
+            v = E.views[i];
+            v.left = E.view->left;
+            v.cols = E.view->cols;
+            break;
+        }
+    }
+    *E.view = v;
+    editorSetView(E.view);
+    editorClampCursor();
+}
 
-// Function to append into a string
-// Takes an append buffer (pointer to string and length)
-// The new string to be appended
-// The size of the strings to be appended
-void abApppend(struct abuf* ab, const char* s, int len) {
-    // We reallocate space for the new string plus the previous
-    char* new = realloc(
-        ab->b, ab->len + len); // Returns a new pointer to available memory
+void editorNextBuffer() {
+    int i = 0;
+    while (E.bufs[i] != E.buf)
+        i++;
+    editorShowBuffer(E.bufs[(i + 1) % E.nbufs]);
+}
 
-    // If the reallocation fails, finish the function
-    if (new == NULL)
+// Opens a file in the current view. A file that is open already is shown
+// from its buffer, it is never loaded twice
+void editorOpenPrompt() {
+    char* filename = editorPrompt("Open: %s (ESC to cancel)", NULL);
+    if (filename == NULL)
         return;
 
-    // We copy the passed string into after the old string (on the new memory
-    // region)
-    memcpy(&new[ab->len], s, len);
-    // Update the pointer in the struct
-    ab->b = new;
-    // Update the length of the string
-    ab->len += len;
+    struct editorBuffer* b = editorFindBuffer(filename);
+    if (b) {
+        editorShowBuffer(b);
+        free(filename);
+        return;
+    }
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        editorSetStatusMessage("Can't open %s: %s", filename,
+                               strerror(errno));
+        free(filename);
+        return;
+    }
+    close(fd);
+    editorShowBuffer(editorNewBuffer());
+    editorOpen(filename);
+    free(filename);
 }
 
-void abFree(struct abuf* ab) {
-    free(ab->b);
+// Whether any buffer has unsaved changes
+int editorAnyDirty() {
+    for (int i = 0; i < E.nbufs; i++) {
+        if (E.bufs[i]->dirty)
+            return 1;
+    }
+    return 0;
 }
 
 /*** output ***/
 
 void editorScroll() {
-    E.rx = 0;
-    if (E.cy < E.numrows) {
-        E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
-    }
+    largeSync();
 
     // Checks if its above visible window
-    if (E.cy < E.rowoff) {
-        E.rowoff = E.cy;
+    if (E.view->cy < E.view->rowoff) {
+        E.view->rowoff = E.view->cy;
     }
 
     // Checks if the cursor is past bottom visible window
-    if (E.cy >= E.rowoff + E.screenrows) {
-        E.rowoff = E.cy - E.screenrows + 1;
+    if (E.view->cy >= E.view->rowoff + E.screenrows) {
+        E.view->rowoff = E.view->cy - E.screenrows + 1;
+    }
+
+    // The cursor row is on screen now, the render and tab index it gets
+    // are dropped with the others once it scrolls off
+    editorRowsKeepRenders(E.view->rowoff, E.view->rowoff + E.screenrows);
+    E.view->rx = 0;
+    if (E.view->cy < E.buf->numrows) {
+        E.view->rx = editorRowCxToRx(editorRow(E.view->cy), E.view->cx);
     }
     // So it doesnt go behind the visible window
-    if (E.rx < E.coloff) {
-        E.coloff = E.rx;
+    if (E.view->rx < E.view->coloff) {
+        E.view->coloff = E.view->rx;
     }
     // So it doesnt go past visible window
-    if (E.rx >= E.coloff + E.screencols) {
-        E.coloff = E.rx - E.screencols + 1;
+    if (E.view->rx >= E.view->coloff + E.view->cols) {
+        E.view->coloff = E.view->rx - E.view->cols + 1;
     }
 }
 
-void editorDrawRows(struct abuf* ab) {
+void editorDrawRows() {
     int y;
 
+    editorRowsKeepRenders(E.view->rowoff, E.view->rowoff + E.screenrows);
+
     // For every available terminal emulator rows
     for (y = 0; y < E.screenrows; y++) {
-        int filerow = y + E.rowoff;
+        int filerow = y + E.view->rowoff;
+
+        editorViewLine(y);
 
         // If the file has more rows than the editor
-        if (filerow >= E.numrows) {
+        if (filerow >= E.buf->numrows) {
             // When it gets to the top center of the screen and we havent
             // printed anything to editor buffer
-            if (E.numrows == 0 && y == E.screenrows / 3) {
+            if (E.buf->numrows == 0 && y == E.screenrows / 3) {
                 char welcome[80];
                 int welcomelen =
                     snprintf(welcome, sizeof(welcome),
@@ -751,118 +3858,147 @@ void editorDrawRows(struct abuf* ab) {
 
                 // Reduce the size of message buffer if the columns size is
                 // lesser than that
-                if (welcomelen > E.screencols)
-                    welcomelen = E.screencols;
+                if (welcomelen > E.view->cols)
+                    welcomelen = E.view->cols;
 
                 // Horizontal padding, it has to be centered
-                int padding = (E.screencols - welcomelen) / 2;
+                int padding = (E.view->cols - welcomelen) / 2;
 
                 // Diferent than cero (not centered)
                 if (padding) {
                     // We draw ~ and pass to the next column
-                    abApppend(ab, "~", 1);
+                    screenPut(&E.back, y, "~", 1, ATTR_NORMAL);
                     padding--;
                 }
 
                 // Until cero, centered, keep printing spaces
-                while (padding--)
-                    abApppend(ab, " ", 1);
+                screenFill(&E.back, y, ' ', padding, ATTR_NORMAL);
 
                 // Print the editor message
-                abApppend(ab, welcome, welcomelen);
+                screenPut(&E.back, y, welcome, welcomelen, ATTR_NORMAL);
 
                 // Either before of after top third of the screen
             } else {
-                abApppend(ab, "~", 1); // Updates buffer appending `~`
+                screenPut(&E.back, y, "~", 1, ATTR_NORMAL);
             }
         } else {
+            erow* row = editorRow(filerow);
+            editorRowEnsureRender(row);
             // Size of row
-            int len = E.row[filerow].rsize - E.coloff;
+            int len = row->rsize - E.view->coloff;
             if (len < 0)
                 len = 0;
 
             // Truncate in case of exceding size of screen
-            if (len > E.screencols)
-                len = E.screencols;
-
-            // Append to append buffer
-            abApppend(ab, &E.row[filerow].render[E.coloff], len);
+            if (len > E.view->cols)
+                len = E.view->cols;
+
+            unsigned char* hl = editorRowHighlight(filerow);
+            if (hl == NULL) {
+                screenPut(&E.back, y, &row->render[E.view->coloff], len,
+                          ATTR_NORMAL);
+                continue;
+            }
+            // Runs of the same attribute
+            int x = E.view->coloff;
+            int end = E.view->coloff + len;
+            while (x < end) {
+                int run = x;
+                while (run < end && hl[run] == hl[x])
+                    run++;
+                screenPut(&E.back, y, &row->render[x], run - x, hl[x]);
+                x = run;
+            }
         }
-
-        abApppend(ab, "\x1b[K", 3); // Clears the line from cursor to end
-
-        abApppend(ab, "\r\n", 2);
     }
 }
 
-void editorDrawStatusBar(struct abuf* ab) {
-    abApppend(ab, "\x1b[7m", 4);
+// Status bar segment of the current view
+void editorDrawStatusBar() {
+    int y = E.screenrows;
     char status[80], rstatus[80];
-    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-                       E.filename ? E.filename : "[No Name]", E.numrows,
-                       E.dirty ? "(modified)" : "");
-    int rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d", E.cy + 1, E.numrows);
-    if (len > E.screencols)
-        len = E.screencols;
-    abApppend(ab, status, len);
-    while (len < E.screencols) {
-        if (E.screencols - len == rlen) {
-            abApppend(ab, rstatus, rlen);
-            break;
-        } else {
-            abApppend(ab, " ", 1);
-            len++;
-        }
+    int len = snprintf(status, sizeof(status), "%.20s - %s%d lines %s",
+                       E.buf->filename ? E.buf->filename : "[No Name]",
+                       L->active && !L->exact ? "~" : "", E.buf->numrows,
+                       E.buf->dirty ? "(modified)" : "");
+    int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d",
+                        E.buf->syntax ? E.buf->syntax->filetype : "no ft",
+                        E.view->cy + 1, E.buf->numrows);
+    if (len > E.view->cols)
+        len = E.view->cols;
+    editorViewLine(y);
+    screenPut(&E.back, y, status, len, ATTR_INVERSE);
+    // Right aligned position if it fits, the bar is inverted to the end
+    if (E.view->cols - len >= rlen) {
+        screenFill(&E.back, y, ' ', E.view->cols - len - rlen, ATTR_INVERSE);
+        screenPut(&E.back, y, rstatus, rlen, ATTR_INVERSE);
+    } else {
+        screenFill(&E.back, y, ' ', E.view->cols - len, ATTR_INVERSE);
     }
-    abApppend(ab, "\x1b[m", 3);
-    abApppend(ab, "\r\n", 2);
 }
 
-void editorDrawMessageBar(struct abuf* ab) {
-    abApppend(ab, "\x1b[K", 3);
+void editorDrawMessageBar() {
+    int y = E.screenrows + 1;
     int msglen = strlen(E.statusmsg);
     if (msglen > E.screencols)
         msglen = E.screencols;
+    screenClearLine(&E.back, y);
     if (msglen && time(NULL) - E.statusmsg_time < 5)
-        abApppend(ab, E.statusmsg, msglen);
+        screenPut(&E.back, y, E.statusmsg, msglen, ATTR_NORMAL);
 }
 
-// Writes escape sequence for clearing terminal
+// Draws the frame of every view into E.back and writes only what differs
+// from E.front, all of it in one write
 void editorRefreshScreen() {
-    editorScroll();
+    double start = traceStart();
+    struct editorView* cur = E.view;
+    for (int i = 0; i < E.nviews; i++) {
+        editorSetView(&E.views[i]);
+        editorScroll();
+        editorDrawRows();
+        editorDrawStatusBar();
+    }
+    editorSetView(cur);
+    editorDrawMessageBar();
 
-    struct abuf ab = ABUF_INIT; // Intializes append buffer
+    // Reused by every frame, after the first few it never reallocates
+    static struct abuf ab = ABUF_INIT;
+    static int last_y = -1;
+    static int last_x = -1;
+    abReset(&ab);
 
     // Hide the cursor
     abApppend(&ab, "\x1b[?25l", 6);
-    // \x1b is 27 in decimal which is the escape character (first of the bytes
-    // that we write) [2j are the rest Escape sequences stat with the escape
-    // character followed by [ and then the command We are using J command
-    // (Erase In Display) with the argument 2 wich clears the whole screen [0j
-    // clears from the cursor on [1j clears up to the cursor abApppend(&ab,
-    // "\x1b[2J", 4); // Deleted, now we just clear to the end of the screen
-
-    // Reposition de cursor
-    // Three bytes long, 27,[,H
-    // H command takes two arguments, row and column. Separated by ;
-    // Row and columns start at 1. Which is also the default
-    abApppend(&ab, "\x1b[H", 3);
-
-    editorDrawRows(&ab);
-    editorDrawStatusBar(&ab);
-    editorDrawMessageBar(&ab);
+
+    screenFlush(&ab);
+
+    // Same frame and cursor as before, nothing to write
+    int y = E.view->cy - E.view->rowoff;
+    int x = E.view->left + E.view->rx - E.view->coloff;
+    if (ab.len == 6 && y == last_y && x == last_x) {
+        traceFrame(start, 0);
+        return;
+    }
+    last_y = y;
+    last_x = x;
 
     char buf[32];
 
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1,
-             (E.rx - E.coloff) + 1); // Moves cursor to the current coordinates
+    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1,
+             x + 1); // Moves cursor to the current coordinates
     abApppend(&ab, buf, strlen(buf));
 
     // Show the cursor
     abApppend(&ab, "\x1b[?25h", 6);
 
-    write(STDOUT_FILENO, ab.b, ab.len); // Writes the lines to the buffer
-    abFree(&ab);
+    // Only the changes are sent, so a frame that didn't get out entirely
+    // leaves the terminal unknown and the next one is drawn from scratch
+    struct iovec iov = {ab.b, ab.len};
+    if (editorWritev(STDOUT_FILENO, &iov, 1) == -1) {
+        E.front_valid = 0;
+        last_y = -1;
+    }
+    traceFrame(start, ab.len);
 }
 
 void editorSetStatusMessage(const char* fmt, ...) {
@@ -884,9 +4020,13 @@ char* editorPrompt(char* prompt, void (*callback)(char*, int)) {
 
     while (1) {
         editorSetStatusMessage(prompt, buf);
-        editorRefreshScreen();
+        // Keys already read are handled before drawing again
+        if (IN.len == 0)
+            editorRefreshScreen();
 
-        int c = editorReadKey();
+        // The callback may have work going on in the background, it gets a
+        // TICK_KEY when no key comes in 50ms
+        int c = editorReadKeyTimeout(callback ? 50 : -1);
         // Deleting
         if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
             if (buflen != 0)
@@ -925,55 +4065,54 @@ char* editorPrompt(char* prompt, void (*callback)(char*, int)) {
 }
 
 void editorMoveCursor(int key) {
-    erow* row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+    erow* row = (E.view->cy >= E.buf->numrows) ? NULL : editorRow(E.view->cy);
     switch (key) {
         // Will later modify to use vim motions
     case ARROW_LEFT:
-        if (E.cx != 0) {
-            E.cx--;
-        } else if (E.cy > 0) {
-            E.cy--;
-            E.cx = E.row[E.cy].size;
+        if (E.view->cx != 0) {
+            E.view->cx--;
+        } else if (E.view->cy > 0) {
+            E.view->cy--;
+            E.view->cx = editorRow(E.view->cy)->size;
         }
         break;
     case ARROW_RIGHT:
-        if (row && E.cx < row->size) {
-            E.cx++;
-        } else if (row && E.cx == row->size) {
-            E.cy++;
-            E.cx = 0;
+        if (row && E.view->cx < row->size) {
+            E.view->cx++;
+        } else if (row && E.view->cx == row->size) {
+            E.view->cy++;
+            E.view->cx = 0;
         }
         break;
     case ARROW_UP:
-        if (E.cy != 0) {
-            E.cy--;
+        if (E.view->cy != 0) {
+            E.view->cy--;
         }
         break;
     case ARROW_DOWN:
-        if (E.cy < E.numrows) {
-            E.cy++;
+        if (E.view->cy < E.buf->numrows) {
+            E.view->cy++;
         }
         break;
     }
-    row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+    row = (E.view->cy >= E.buf->numrows) ? NULL : editorRow(E.view->cy);
     int rowlen = row ? row->size : 0;
-    if (E.cx > rowlen) {
-        E.cx = rowlen;
+    if (E.view->cx > rowlen) {
+        E.view->cx = rowlen;
     }
 }
 
-// waits for keypress and then handles it.
-void editorProcessKeypress() {
+// handles a keypress
+void editorProcessKeypress(int c) {
     static int quit_times = KILO_QUIT_TIMES;
 
-    int c = editorReadKey();
     // When ctrl + q is pressed exit the program with  status 0
     switch (c) {
     case '\r':
         editorInsertNewline();
         break;
     case CTRL_KEY('q'):
-        if (E.dirty && quit_times > 0) {
+        if (editorAnyDirty() && quit_times > 0) {
             editorSetStatusMessage("WARNING! File has unsaveed changes. "
                                    " Pres Ctrl-Q %d  more times to quit.",
                                    quit_times);
@@ -990,15 +4129,36 @@ void editorProcessKeypress() {
         /** movement **/
 
     case HOME_KEY:
-        E.cx = 0;
+        E.view->cx = 0;
         break;
     case END_KEY:
-        if (E.cy < E.numrows)
-            E.cx = E.row[E.cy].size;
+        if (E.view->cy < E.buf->numrows)
+            E.view->cx = editorRow(E.view->cy)->size;
         break;
     case CTRL_KEY('f'):
         editorFind();
         break;
+    case CTRL_KEY('z'):
+        editorUndo();
+        break;
+    case CTRL_KEY('y'):
+        editorRedo();
+        break;
+    case CTRL_KEY('o'):
+        editorOpenPrompt();
+        break;
+    case CTRL_KEY('b'):
+        editorNextBuffer();
+        break;
+    case CTRL_KEY('t'):
+        editorSplitView();
+        break;
+    case CTRL_KEY('n'):
+        editorFocusView((E.view - E.views + 1) % E.nviews);
+        break;
+    case CTRL_KEY('w'):
+        editorCloseView();
+        break;
     case BACKSPACE:
 
     case CTRL_KEY('h'):
@@ -1010,11 +4170,11 @@ void editorProcessKeypress() {
     case PAGE_UP:
     case PAGE_DOWN: {
         if (c == PAGE_UP) {
-            E.cy = E.rowoff;
+            E.view->cy = E.view->rowoff;
         } else if (c == PAGE_DOWN) {
-            E.cy = E.rowoff + E.screenrows - 1;
-            if (E.cy > E.numrows)
-                E.cy = E.numrows;
+            E.view->cy = E.view->rowoff + E.screenrows - 1;
+            if (E.view->cy > E.buf->numrows)
+                E.view->cy = E.buf->numrows;
         }
         int times = E.screenrows;
         while (times--)
@@ -1040,41 +4200,324 @@ void editorProcessKeypress() {
 
 /*** init ***/
 
-void initEditor() {
-    E.cx = 0;
-    E.cy = 0;
-    E.rx = 0;
-    E.rowoff = 0;
-    E.coloff = 0;
-    E.numrows = 0;
-    E.row = NULL;
-    E.dirty = 0;
-    E.filename = NULL;
+// rows and cols of the terminal, 0 asks the terminal for its size
+void initEditor(int rows, int cols) {
+    // One view on an empty buffer
+    E.views[0] = (struct editorView){.buf = editorNewBuffer()};
+    E.nviews = 1;
+    editorSetView(&E.views[0]);
     E.statusmsg[0] = '\0';
     E.statusmsg_time = 0;
-    if (getWindowSize(&E.screenrows, &E.screencols) == -1)
+    E.screenrows = rows;
+    E.screencols = cols;
+    if (rows == 0 && getWindowSize(&E.screenrows, &E.screencols) == -1)
         die("getWindowSize");
     E.screenrows -= 2;
+    // Text area plus the status and message bar
+    screenInit(&E.front, E.screenrows + 2, E.screencols);
+    screenInit(&E.back, E.screenrows + 2, E.screencols);
+    E.front_valid = 0;
+    E.front_rowoff = 0;
+    editorLayoutViews();
+}
+
+/*** benchmark ***/
+
+// Draws frames of filename on a fake 24x80 terminal without raw mode. The
+// frames go to stdout and the stats to stderr:
+//   ./main --bench-frames file > /dev/null
+// Half the frames scroll down a row, the other half type on a row
+int editorBenchFrames(char* filename) {
+    const int frames = 20000;
+
+    initEditor(24, 80);
+    editorOpen(filename);
+
+    long bytes = ab_bytes;
+    long appends = ab_appends;
+    long grows = ab_grows;
+    double start = benchNow();
+
+    for (int i = 0; i < frames; i++) {
+        if (i < frames / 2) {
+            editorMoveCursor(ARROW_DOWN);
+            if (E.view->cy >= E.buf->numrows)
+                E.view->cy = 0;
+        } else {
+            editorInsertChar('a' + i % 26);
+        }
+        editorRefreshScreen();
+    }
+
+    double elapsed = benchNow() - start;
+    bytes = ab_bytes - bytes;
+    appends = ab_appends - appends;
+    grows = ab_grows - grows;
+
+    fprintf(stderr, "%d frames of %s\n", frames, filename);
+    fprintf(stderr, "  %.2f us/frame\n", elapsed * 1e6 / frames);
+    fprintf(stderr, "  %.1f bytes/frame\n", (double)bytes / frames);
+    fprintf(stderr, "  %.1f appends/frame (one realloc each before)\n",
+            (double)appends / frames);
+    fprintf(stderr, "  %.4f reallocs/frame (%ld total)\n",
+            (double)grows / frames, grows);
+    return 0;
+}
+
+// Keys replayed when no script is given: scrolling and paging through the
+// file, then typing, deleting and undoing at its end
+char* benchDefaultKeys(int* len) {
+    struct abuf ab = ABUF_INIT;
+    for (int i = 0; i < 200; i++)
+        abApppend(&ab, "\x1b[B", 3);
+    for (int i = 0; i < 20; i++)
+        abApppend(&ab, "\x1b[6~", 4);
+    for (int i = 0; i < 20; i++)
+        abApppend(&ab, "\x1b[5~", 4);
+    abApppend(&ab, "\x1b[F", 3);
+    for (int i = 0; i < 200; i++) {
+        char c = i % 40 == 39 ? '\r' : 'a' + i % 26;
+        abApppend(&ab, &c, 1);
+    }
+    for (int i = 0; i < 50; i++)
+        abApppend(&ab, "\x7f", 1);
+    for (int i = 0; i < 20; i++)
+        abApppend(&ab, "\x1a", 1);
+    *len = ab.len;
+    return ab.b;
+}
+
+char* benchReadFile(char* filename, int* len) {
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1)
+        die(filename);
+    char* buf = malloc(st.st_size + 1);
+    if (buf == NULL)
+        die("malloc");
+    *len = 0;
+    ssize_t n;
+    while (*len < st.st_size &&
+           (n = read(fd, &buf[*len], st.st_size - *len)) > 0)
+        *len += n;
+    close(fd);
+    return buf;
+}
+
+// What one replayed key cost, times in microseconds
+typedef struct benchFrame {
+    double latency; // from writing the key until the trace has its frame
+    double process; // in editorProcessKeypress
+    double refresh; // in editorRefreshScreen
+    double bytes;   // written to the terminal
+} benchFrame;
+
+// Reads the editor until its trace has a frame for at least min_keys keys,
+// the terminal output is only drained. Returns 0 if the editor is gone or
+// took more than 5 seconds
+int benchWaitFrame(int master, int trace, int min_keys, benchFrame* fr) {
+    static char buf[4096];
+    static int len = 0;
+    double deadline = benchNow() + 5;
+
+    while (1) {
+        char* nl;
+        while ((nl = memchr(buf, '\n', len))) {
+            *nl = '\0';
+            int key, keys, bytes;
+            double us;
+            int done = 0;
+            if (sscanf(buf, "k %d %lf", &key, &us) == 2) {
+                fr->process += us;
+            } else if (sscanf(buf, "f %d %lf %d", &keys, &us, &bytes) == 3 &&
+                       keys >= min_keys) {
+                fr->refresh = us;
+                fr->bytes = bytes;
+                done = 1;
+            }
+            len -= nl + 1 - buf;
+            memmove(buf, nl + 1, len);
+            if (done)
+                return 1;
+        }
+
+        int left = (deadline - benchNow()) * 1000;
+        if (left <= 0)
+            return 0;
+        struct pollfd pfd[2] = {{master, POLLIN, 0}, {trace, POLLIN, 0}};
+        if (poll(pfd, 2, left) <= 0)
+            continue;
+        if (pfd[0].revents & POLLIN) {
+            char out[65536];
+            if (read(master, out, sizeof(out)) <= 0)
+                return 0;
+        }
+        if (pfd[1].revents & (POLLIN | POLLHUP)) {
+            ssize_t n = read(trace, &buf[len], sizeof(buf) - len);
+            if (n <= 0)
+                return 0;
+            len += n;
+        }
+    }
+}
+
+int benchCompare(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Percentiles of the field at offset off of every frame
+void benchPrintStat(const char* name, benchFrame* frames, int n, size_t off) {
+    double* v = malloc(sizeof(double) * (n ? n : 1));
+    if (v == NULL)
+        die("malloc");
+    for (int i = 0; i < n; i++)
+        v[i] = *(double*)((char*)&frames[i] + off);
+    qsort(v, n, sizeof(double), benchCompare);
+    printf("  %-18s p50 %9.1f  p99 %9.1f  max %9.1f\n", name,
+           n ? v[n / 2] : 0, n ? v[(int)(0.99 * (n - 1))] : 0,
+           n ? v[n - 1] : 0);
+    free(v);
+}
+
+// Plays keys back against filename in an editor on a 24x80 pseudo-terminal,
+// one key at a time, and reports how long each took until its frame was
+// written:
+//   ./main --bench-replay file [keys]
+// keys is a file made with --record, a built-in script when there is none.
+// The editor runs with --trace into a pipe, a frame that changes nothing
+// writes no output but still has its line there. Nothing is saved unless
+// the keys do it
+int editorBenchReplay(char* filename, char* script) {
+    int len;
+    char* keys = script ? benchReadFile(script, &len) : benchDefaultKeys(&len);
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1)
+        die("posix_openpt");
+    struct winsize ws = {24, 80, 0, 0};
+    ioctl(master, TIOCSWINSZ, &ws);
+    int tp[2];
+    if (pipe(tp) == -1)
+        die("pipe");
+
+    pid_t pid = fork();
+    if (pid == -1)
+        die("fork");
+    if (pid == 0) {
+        // The pseudo-terminal becomes the controlling terminal of the editor
+        setsid();
+        int slave = open(ptsname(master), O_RDWR);
+        if (slave == -1)
+            _exit(127);
+        dup2(slave, STDIN_FILENO);
+        dup2(slave, STDOUT_FILENO);
+        close(slave);
+        close(master);
+        close(tp[0]);
+        char trace[32];
+        snprintf(trace, sizeof(trace), "/dev/fd/%d", tp[1]);
+        execl("/proc/self/exe", "main", "--trace", trace, filename,
+              (char*)NULL);
+        _exit(127);
+    }
+    close(tp[1]);
+
+    benchFrame* frames = malloc(sizeof(benchFrame) * (len ? len : 1));
+    if (frames == NULL)
+        die("malloc");
+    int n = 0;
+    benchFrame first = {0, 0, 0, 0};
+    int ok = benchWaitFrame(master, tp[0], 0, &first);
+    for (int i = 0; ok && i < len;) {
+        int key;
+        int k = editorParseKey(&keys[i], len - i, &key);
+        // An escape sequence cut short is sent as it is
+        if (k < 0)
+            k = -k;
+        benchFrame fr = {0, 0, 0, 0};
+        double start = benchNow();
+        if (write(master, &keys[i], k) != k)
+            break;
+        i += k;
+        ok = benchWaitFrame(master, tp[0], 1, &fr);
+        fr.latency = (benchNow() - start) * 1e6;
+        if (ok)
+            frames[n++] = fr;
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+
+    printf("%d keys replayed on %s%s\n", n, filename,
+           ok ? "" : " (the editor stopped early)");
+    benchPrintStat("key to frame us", frames, n,
+                   offsetof(benchFrame, latency));
+    benchPrintStat("keypress us", frames, n, offsetof(benchFrame, process));
+    benchPrintStat("refresh us", frames, n, offsetof(benchFrame, refresh));
+    benchPrintStat("bytes", frames, n, offsetof(benchFrame, bytes));
+    free(frames);
+    free(keys);
+    return ok ? 0 : 1;
 }
 
 int main(int argc, char* argv[]) {
+    if (argc >= 3 && strcmp(argv[1], "--bench-frames") == 0)
+        return editorBenchFrames(argv[2]);
+    if (argc >= 3 && strcmp(argv[1], "--bench-replay") == 0)
+        return editorBenchReplay(argv[2], argc >= 4 ? argv[3] : NULL);
+
+    // Options come before the file name
+    while (argc >= 2 && strncmp(argv[1], "--", 2) == 0) {
+        if (strcmp(argv[1], "--large") == 0) {
+            large_forced = 1;
+        } else if (argc >= 3 && strcmp(argv[1], "--trace") == 0) {
+            T.out = fopen(argv[2], "w");
+            if (T.out == NULL)
+                die("fopen");
+            // Whoever reads it sees every line as soon as it is written
+            setvbuf(T.out, NULL, _IOLBF, 0);
+            argv++;
+            argc--;
+        } else if (argc >= 3 && strcmp(argv[1], "--record") == 0) {
+            T.record = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (T.record == -1)
+                die("open");
+            argv++;
+            argc--;
+        } else {
+            fprintf(stderr, "unknown option %s\n", argv[1]);
+            return 1;
+        }
+        argv++;
+        argc--;
+    }
+
     enableRawMode();
     // Initializes the E struct (aka global configuration)
-    initEditor();
+    initEditor(0, 0);
     if (argc >= 2) {
         editorOpen(argv[1]);
     }
 
+    // Every key, short enough for the 79 characters of the message bar
     editorSetStatusMessage(
-        "HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find", ARROW_RIGHT,
-        PAGE_DOWN);
+        "^S save ^Q quit ^F find ^Z/Y undo ^O open ^B buffer ^T split ^N view ^W close",
+        ARROW_RIGHT, PAGE_DOWN);
 
-    // Reads 1 byte from file descriptor STDIN_FILENO aka 0 aka standard input
-    // on Unix, into c (buffer) When it reads 'Ctrl-q' exits the program.
+    // Sleeps in poll() until a key comes or a timer is due. Every key that
+    // already arrived is applied before the next frame, so a paste is drawn
+    // once instead of once per character. Ctrl-q exits the program.
     while (1) {
-        // Clears screen
         editorRefreshScreen();
-        editorProcessKeypress();
+        int c = editorReadKeyTimeout(editorNextTimer());
+        while (c != TICK_KEY) {
+            double start = traceStart();
+            editorProcessKeypress(c);
+            traceKey(c, start);
+            // Page up/down go by the viewport the previous key left
+            editorScroll();
+            c = editorReadKeyTimeout(0);
+        }
     }
 
     return 0;
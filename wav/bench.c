@@ -0,0 +1,323 @@
+// Samples/sec of the synth engine against the original per sample sinf loop
+//
+//   ./bench [seconds of audio] [max threads]
+#define _DEFAULT_SOURCE
+#include "render.h"
+#include "resample.h"
+#include "synth.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FREQ 44100
+
+typedef double f64;
+
+static volatile i16 s_sink;
+
+static f64 now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (f64)ts.tv_sec + (f64)ts.tv_nsec * 1e-9;
+}
+
+static void report(const char* what, u64 samples, f64 sec)
+{
+    printf("%-28s %10.1f Msamples/s %8.2fx realtime\n", what,
+           (f64)samples / sec * 1e-6, (f64)samples / FREQ / sec);
+}
+
+// The loop main.c used to run, note lookup and sinf per sample
+static void bench_scalar(const f32* freqs, const f32* durs, u32 num_notes,
+                         u64 num_sample)
+{
+    i16 acc = 0;
+    f64 start = now_sec();
+
+    u32 cur_note = 0;
+    f32 cur_note_start = 0.0f;
+    for (u64 i = 0; i < num_sample; i++)
+    {
+        f32 t = (f32)i / FREQ;
+        f32 y = 0.0f;
+        if (cur_note < num_notes)
+        {
+            y = 0.25f * sinf(t * freqs[cur_note] * 2.0f * 3.1415926535f);
+
+            if (t > cur_note_start + durs[cur_note])
+            {
+                cur_note++;
+                cur_note_start = t;
+            }
+        }
+        acc ^= (i16)(y * INT16_MAX);
+    }
+
+    report("scalar sinf loop", num_sample, now_sec() - start);
+    s_sink = acc;
+}
+
+static void bench_synth(const synth* s, u32 voices_per_sample)
+{
+    f32 mix[SYNTH_BLOCK];
+    i16 block[SYNTH_BLOCK];
+    i16 acc = 0;
+
+    f64 start = now_sec();
+    for (u64 pos = 0; pos < s->length; pos += SYNTH_BLOCK)
+    {
+        u32 frames =
+            s->length - pos < SYNTH_BLOCK ? s->length - pos : SYNTH_BLOCK;
+        synth_render(s, pos, mix, frames);
+        wav_f32_to_i16(mix, block, frames);
+        acc ^= block[0];
+    }
+    f64 sec = now_sec() - start;
+
+    char what[64];
+    snprintf(what, sizeof(what), "synth, %u voice(s)", voices_per_sample);
+    report(what, s->length, sec);
+    s_sink = acc;
+}
+
+static void bench_convert(u64 count)
+{
+    f32* in = malloc(sizeof(f32) * count);
+    i16* out = malloc(sizeof(i16) * count);
+    for (u64 i = 0; i < count; i++)
+        in[i] = sinf((f32)i * 0.001f) * 1.5f;
+
+    f64 start = now_sec();
+    wav_f32_to_i16(in, out, count);
+    report("f32 -> i16 saturate", count, now_sec() - start);
+
+    s_sink = out[count / 2];
+    free(in);
+    free(out);
+}
+
+// Planar floats converted and interleaved by the writer for every format,
+// then read back to check the header
+static void bench_formats(u64 frames)
+{
+    static const struct
+    {
+        const char* name;
+        u16 channels;
+        wav_sample_type type;
+    } cases[] = {
+        {"pcm16 stereo", 2, WAV_PCM16},   {"pcm24 stereo", 2, WAV_PCM24},
+        {"float32 stereo", 2, WAV_FLOAT32}, {"pcm16 5.1", 6, WAV_PCM16},
+        {"pcm24 5.1", 6, WAV_PCM24},      {"float32 5.1", 6, WAV_FLOAT32},
+    };
+
+    f32* plane = malloc(sizeof(f32) * frames);
+    for (u64 i = 0; i < frames; i++)
+        plane[i] = sinf((f32)i * 0.01f) * 0.5f;
+    const f32* planes[6] = {plane, plane, plane, plane, plane, plane};
+
+    char path[] = "/tmp/wav_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1)
+        return;
+    close(fd);
+
+    for (u32 i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        wav_format fmt = wav_format_make(FREQ, cases[i].channels, cases[i].type);
+        f64 start = now_sec();
+        wav_writer* w = wav_writer_open_format(path, &fmt);
+        if (!w)
+            break;
+        wav_writer_append_f32(w, planes, frames);
+        wav_writer_close(w);
+        f64 sec = now_sec() - start;
+
+        wav_reader r;
+        b32 ok = wav_reader_open(&r, path) && r.channels == fmt.channels &&
+                 r.frames == frames &&
+                 r.bits_per_sample == wav_format_sample_bytes(&fmt) * 8;
+        wav_reader_close(&r);
+
+        char what[64];
+        snprintf(what, sizeof(what), "write %s%s", cases[i].name,
+                 ok ? "" : " (BAD HEADER)");
+        report(what, frames * fmt.channels, sec);
+    }
+
+    unlink(path);
+    free(plane);
+}
+
+// Output samples/sec and SNR against an exact tone at the output rate
+static void bench_resample(u32 out_rate, f64 tone, u64 count)
+{
+    resampler rs;
+    if (!resampler_init(&rs, FREQ, out_rate))
+        return;
+
+    f32* in = malloc(sizeof(f32) * count);
+    f32* out = malloc(sizeof(f32) * (resampler_max_output(&rs, count) +
+                                     resampler_max_output(&rs, RESAMPLE_TAPS)));
+    // double precision phase, a float sinf argument would cap the SNR itself
+    for (u64 i = 0; i < count; i++)
+        in[i] = (f32)(0.5 * sin(2.0 * M_PI * tone * i / FREQ));
+
+    // Fed in synth sized blocks like the streaming pipeline does
+    u64 written = 0;
+    f64 start = now_sec();
+    for (u64 pos = 0; pos < count; pos += SYNTH_BLOCK)
+    {
+        u64 n = count - pos < SYNTH_BLOCK ? count - pos : SYNTH_BLOCK;
+        written += resampler_process(&rs, &in[pos], n, &out[written]);
+    }
+    written += resampler_flush(&rs, &out[written]);
+    f64 sec = now_sec() - start;
+
+    // Skip the edges where the filter sees the silence around the stream
+    f64 signal = 0.0, noise = 0.0;
+    for (u64 i = RESAMPLE_TAPS * 4; i + RESAMPLE_TAPS * 4 < written; i++)
+    {
+        f64 ref = 0.5 * sin(2.0 * M_PI * tone * i / out_rate);
+        signal += ref * ref;
+        noise += (out[i] - ref) * (out[i] - ref);
+    }
+
+    char what[64];
+    snprintf(what, sizeof(what), "resample %u -> %u (%.0f Hz)", FREQ, out_rate,
+             tone);
+    printf("%-28s %10.1f Msamples/s %8.1f dB SNR\n", what,
+           (f64)written / sec * 1e-6, 10.0 * log10(signal / noise));
+
+    resampler_free(&rs);
+    free(in);
+    free(out);
+}
+
+// Stereo file rendered with 1, 2, 4... threads into a mapped output file
+static void bench_parallel(const synth* tracks, u32 max_threads)
+{
+    char path[] = "/tmp/wav_bench_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1)
+        return;
+    close(fd);
+
+    for (u32 threads = 1; threads <= max_threads; threads *= 2)
+    {
+        f64 start = now_sec();
+        wav_format fmt = wav_format_make(FREQ, 2, WAV_PCM16);
+        if (!render_parallel(tracks, &fmt, path, threads))
+        {
+            perror(path);
+            break;
+        }
+        char what[64];
+        snprintf(what, sizeof(what), "parallel stereo, %u thread(s)", threads);
+        report(what, tracks[0].length * 2, now_sec() - start);
+    }
+
+    // Read it back through the zero copy reader, RMS over every sample
+    wav_reader r;
+    if (wav_reader_open(&r, path))
+    {
+        wav_iter it;
+        const u8* frames;
+        u64 count;
+        f64 sq = 0.0;
+
+        f64 start = now_sec();
+        wav_iter_begin(&it, &r, 1u << 20);
+        while ((count = wav_iter_next(&it, &frames)))
+        {
+            const i16* s = (const i16*)frames;
+            for (u64 i = 0; i < count * r.channels; i++)
+                sq += (f64)s[i] * s[i];
+        }
+        f64 sec = now_sec() - start;
+
+        printf("%-28s %10.2f GB/s (rms %.0f)\n", "mmap reader scan",
+               (f64)r.data_size / sec * 1e-9,
+               sqrt(sq / (f64)(r.frames * r.channels)));
+        wav_reader_close(&r);
+    }
+    unlink(path);
+}
+
+int main(int argc, char* argv[])
+{
+    f32 seconds = argc > 1 ? (f32)atof(argv[1]) : 600.0f;
+    u32 max_threads = argc > 2 ? (u32)atoi(argv[2])
+                               : (u32)sysconf(_SC_NPROCESSORS_ONLN);
+
+    // Same melody as main.c looped to the requested length
+    const f32 freqs[] = {392, 440, 294, 440, 494};
+    const f32 durs[] = {60.0f / 76, 60.0f / 76, 60.0f / 114, 60.0f / 76,
+                        60.0f / 76};
+    u32 melody_len = sizeof(freqs) / sizeof(freqs[0]);
+
+    u32 num_notes = 0;
+    f32 total = 0.0f;
+    while (total < seconds)
+        total += durs[num_notes++ % melody_len];
+
+    f32* loop_freqs = malloc(sizeof(f32) * num_notes);
+    f32* loop_durs = malloc(sizeof(f32) * num_notes);
+    for (u32 i = 0; i < num_notes; i++)
+    {
+        loop_freqs[i] = freqs[i % melody_len];
+        loop_durs[i] = durs[i % melody_len];
+    }
+
+    printf("%.0f s of audio, %u notes\n", total, num_notes);
+    bench_scalar(loop_freqs, loop_durs, num_notes, (u64)(total * FREQ));
+
+    synth_envelope env = {0.005f, 0.05f, 0.8f, 0.02f};
+    for (u32 poly = 1; poly <= 4; poly *= 2)
+    {
+        synth s;
+        synth_init(&s, FREQ, env);
+        f32 start = 0.0f;
+        for (u32 i = 0; i < num_notes; i++)
+        {
+            // stacked voices a fifth apart
+            for (u32 p = 0; p < poly; p++)
+                synth_add_note(&s, start, loop_durs[i],
+                               loop_freqs[i] * (1.0f + 0.5f * p), 0.25f / poly);
+            start += loop_durs[i];
+        }
+        bench_synth(&s, poly);
+        synth_free(&s);
+    }
+
+    bench_convert((u64)(total * FREQ));
+    bench_formats((u64)(total * FREQ));
+    bench_resample(48000, 1000.0, (u64)(total * FREQ));
+    bench_resample(48000, 15000.0, (u64)(total * FREQ));
+    bench_resample(96000, 1000.0, (u64)(total * FREQ));
+    bench_resample(96000, 15000.0, (u64)(total * FREQ));
+
+    // left is the melody, right the melody an octave up
+    synth tracks[2];
+    for (u32 c = 0; c < 2; c++)
+    {
+        synth_init(&tracks[c], FREQ, env);
+        f32 start = 0.0f;
+        for (u32 i = 0; i < num_notes; i++)
+        {
+            synth_add_note(&tracks[c], start, loop_durs[i],
+                           loop_freqs[i] * (1.0f + c), 0.25f);
+            start += loop_durs[i];
+        }
+    }
+    bench_parallel(tracks, max_threads);
+    synth_free(&tracks[0]);
+    synth_free(&tracks[1]);
+
+    free(loop_freqs);
+    free(loop_durs);
+    return 0;
+}
@@ -1,31 +1,63 @@
-#include <math.h>
+#include "render.h"
+#include "resample.h"
+#include "synth.h"
+#include "wav.h"
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-typedef int16_t i16;
-typedef uint16_t u16;
-typedef uint32_t u32;
-
-typedef float f32;
-
-void write_le_16(FILE* f, u16 n)
-{
-    fwrite(&n, sizeof(u16), 1, f);
-}
+#define FREQ 44100
 
-void write_le_32(FILE* f, u32 n)
+// ./main [-f 16|24|float] [-r rate] [-j threads]
+//   -f  sample format of test.wav, 16 bit PCM by default
+//   -r  output sample rate, the song is synthesized at FREQ and resampled
+//   -j  renders with render_parallel instead of streaming (0 = every core),
+//       the synth then runs at the output rate directly
+static int usage(const char* prog)
 {
-    fwrite(&n, sizeof(u32), 1, f);
+    fprintf(stderr, "usage: %s [-f 16|24|float] [-r rate] [-j threads]\n", prog);
+    return 1;
 }
 
-#define WRITE_STR_LIT(f, s) fwrite((s), 1, sizeof(s) - 1, f)
-
-#define FREQ 44100
-
-int main(void)
+int main(int argc, char* argv[])
 {
-    FILE* f = fopen("test.wav", "wb");
+    wav_sample_type type = WAV_PCM16;
+    u32 rate = FREQ;
+    int threads = -1;
+    int opt;
+    while ((opt = getopt(argc, argv, "f:r:j:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'f':
+            if (strcmp(optarg, "24") == 0)
+                type = WAV_PCM24;
+            else if (strcmp(optarg, "float") == 0)
+                type = WAV_FLOAT32;
+            else if (strcmp(optarg, "16") != 0)
+                return usage(argv[0]);
+            break;
+        case 'r':
+        {
+            // Checked before test.wav is created, a bad rate leaves no file
+            char* end;
+            unsigned long r = strtoul(optarg, &end, 10);
+            if (end == optarg || *end || r == 0 || r > UINT32_MAX)
+                return usage(argv[0]);
+            rate = (u32)r;
+            break;
+        }
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+    wav_format fmt = wav_format_make(rate, 1, type);
 
     // Notes with frequency and duration
     struct
@@ -39,74 +71,103 @@ int main(void)
 
     u32 num_notes = sizeof(notes) / sizeof(notes[0]);
 
-    f32 duration = 0.0f;
+    // Short attack and release so note changes don't click
+    synth_envelope env = {0.005f, 0.05f, 0.8f, 0.02f};
+    synth s;
+    synth_init(&s, threads >= 0 ? rate : FREQ, env);
+
+    f32 start = 0.0f;
     for (u32 i = 0; i < num_notes; i++)
     {
-        duration += notes[i].dur;
+        synth_add_note(&s, start, notes[i].dur, notes[i].freq, 0.25f);
+        start += notes[i].dur;
     }
 
-    // *** Header *** //
-    u32 num_sample = (u32)(duration * FREQ);
-    // Size of header plus samples
-    u32 file_size = num_sample * sizeof(u16) + 44;
-
-    // FileTypeBlocID - Identifier
-    WRITE_STR_LIT(f, "RIFF");
-    // FileSize - Overall file size minus 8 bytes
-    write_le_32(f, file_size - 8);
-    // FileFormatID - Format
-    WRITE_STR_LIT(f, "WAVE");
-
-    // *** Describes the data format *** ///
-    // FormatBlocID - Identifier
-    WRITE_STR_LIT(f, "fmt ");
-    // BlocSize - 16bytes constant
-    write_le_32(f, 16);
-    // AudioFormat - PCM Integer
-    write_le_16(f, 1);
-    // Number of channels - 1
-    write_le_16(f, 1);
-    // Sample rate
-    write_le_32(f, FREQ);
-    // BytePerSec - FREQ * BytePerBloc
-    write_le_32(f, FREQ * sizeof(u16));
-    // BytePerBloc - Channels * BitsPerSample / 8
-    write_le_16(f, sizeof(u16));
-    // BitsPerSample
-    write_le_16(f, sizeof(u16) * 8);
+    if (threads >= 0)
+    {
+        b32 ok = render_parallel(&s, &fmt, "test.wav", (u32)threads);
+        synth_free(&s);
+        if (!ok)
+        {
+            perror("test.wav");
+            return 1;
+        }
+        return 0;
+    }
 
-    // *** Chunk Containing the sampled data *** //
-    // DataBlocID
-    WRITE_STR_LIT(f, "data");
-    // DataSize
-    write_le_32(f, num_sample * sizeof(u16));
+    // *** Writing Sample *** //
 
+    // Resampler sits between the synth and the writer, skipped at FREQ.
+    // Set up first, so a rate it can't do leaves no test.wav behind
+    resampler rs;
+    b32 resample = rate != FREQ;
+    if (resample && !resampler_init(&rs, FREQ, rate))
+    {
+        fprintf(stderr, "can't resample %u -> %u\n", FREQ, rate);
+        synth_free(&s);
+        return 1;
+    }
 
-    // *** Writing Sample *** //
+    wav_writer* w = wav_writer_open_format("test.wav", &fmt);
+    if (!w)
+    {
+        if (resample)
+            resampler_free(&rs);
+        synth_free(&s);
+        perror("test.wav");
+        return 1;
+    }
 
-    u32 cur_note = 0;
-    f32 cur_note_start = 0.0f;
-    for (u32 i = 0; i < num_sample; i++)
+    f32 mix[SYNTH_BLOCK];
+    const f32* planes[1] = {mix};
+    // Room for one block or for the flush, whichever produces more
+    f32* resampled = NULL;
+    if (resample)
     {
-        f32 t = (f32)i / FREQ;
-        f32 y = 0.0f;
-        if (cur_note < num_notes)
+        u64 cap = resampler_max_output(&rs, SYNTH_BLOCK);
+        if (RESAMPLE_TAPS > SYNTH_BLOCK)
+            cap = resampler_max_output(&rs, RESAMPLE_TAPS);
+        resampled = malloc(sizeof(f32) * cap);
+        if (!resampled)
         {
-            y = 0.25f * sinf(t * notes[cur_note].freq * 2.0f * 3.1415926535f);
-
-            if (t > cur_note_start + notes[cur_note].dur)
-            {
-                cur_note++;
-                cur_note_start = t;
-            }
+            fprintf(stderr, "out of memory\n");
+            resampler_free(&rs);
+            synth_free(&s);
+            wav_writer_close(w);
+            return 1;
         }
+    }
+    const f32* resampled_planes[1] = {resampled};
+    for (u64 pos = 0; pos < s.length; pos += SYNTH_BLOCK)
+    {
+        u32 frames = s.length - pos < SYNTH_BLOCK ? s.length - pos : SYNTH_BLOCK;
+        synth_render(&s, pos, mix, frames);
+        // converted to the file format inside the writer's buffer
+        if (resample)
+        {
+            u64 n = resampler_process(&rs, mix, frames, resampled);
+            wav_writer_append_f32(w, resampled_planes, n);
+        }
+        else
+        {
+            wav_writer_append_f32(w, planes, frames);
+        }
+    }
+    if (resample)
+    {
+        u64 n = resampler_flush(&rs, resampled);
+        wav_writer_append_f32(w, resampled_planes, n);
+        resampler_free(&rs);
+        free(resampled);
+    }
 
-        i16 sample = (i16)(y * INT16_MAX);
+    synth_free(&s);
 
-        write_le_16(f, sample);
+    if (!wav_writer_close(w))
+    {
+        perror("test.wav");
+        return 1;
     }
 
-    fclose(f);
-
     return 0;
 }
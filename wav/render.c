@@ -0,0 +1,144 @@
+#if defined(__linux__) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include "render.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// inline min and max of two numbers
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+#define RENDER_MAX_THREADS 256
+
+// Shared by every worker, only next_chunk is written after start
+typedef struct
+{
+    const synth* tracks;
+    wav_format fmt;
+    u16 frame_bytes;
+    u64 frames;
+    u64 num_chunks;
+    u8* samples; // interleaved data chunk inside the mapping
+
+    u64 next_chunk; // atomic work queue
+    b32 failed;     // atomic, a worker couldn't start, the file is incomplete
+} render_job;
+
+// planes holds SYNTH_BLOCK floats per channel
+static void render_chunk(render_job* job, u64 chunk, f32* planes)
+{
+    u64 first = chunk * RENDER_CHUNK_FRAMES;
+    u64 last = MIN(first + RENDER_CHUNK_FRAMES, job->frames);
+    u16 channels = job->fmt.channels;
+    const f32* rows[channels];
+
+    for (u16 c = 0; c < channels; c++)
+        rows[c] = &planes[c * SYNTH_BLOCK];
+
+    for (u64 pos = first; pos < last; pos += SYNTH_BLOCK)
+    {
+        u32 frames = (u32)MIN(SYNTH_BLOCK, last - pos);
+        for (u16 c = 0; c < channels; c++)
+            synth_render(&job->tracks[c], pos, &planes[c * SYNTH_BLOCK], frames);
+        // Converted and interleaved straight into the mapped file
+        wav_interleave_f32(&job->fmt, rows, frames,
+                           &job->samples[pos * job->frame_bytes]);
+    }
+}
+
+static void* render_worker(void* arg)
+{
+    render_job* job = arg;
+    f32* planes = malloc(sizeof(f32) * SYNTH_BLOCK * job->fmt.channels);
+    if (!planes)
+    {
+        __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    for (;;)
+    {
+        u64 chunk = __atomic_fetch_add(&job->next_chunk, 1, __ATOMIC_RELAXED);
+        if (chunk >= job->num_chunks)
+            break;
+        render_chunk(job, chunk, planes);
+    }
+
+    free(planes);
+    return NULL;
+}
+
+b32 render_parallel(const synth* tracks, const wav_format* fmt, const char* path,
+                    u32 num_threads)
+{
+    u16 channels = fmt->channels;
+    if (channels == 0)
+        return 0;
+
+    u64 frames = 0;
+    for (u16 c = 0; c < channels; c++)
+        frames = MAX(frames, tracks[c].length);
+
+    u8 header[WAV_HEADER_MAX_SIZE];
+    u16 frame_bytes = channels * wav_format_sample_bytes(fmt);
+    u64 data_size = frames * frame_bytes;
+    u32 header_size = wav_header_build(header, fmt, data_size);
+    // odd sized data gets the RIFF pad byte, posix_fallocate leaves it zeroed
+    u64 file_size = header_size + data_size + (data_size & 1);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        return 0;
+    // Blocks are allocated up front, so a full disk fails here instead of
+    // raising SIGBUS while the shared mapping is written
+    if (posix_fallocate(fd, 0, (off_t)file_size) != 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    u8* map = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        close(fd);
+        return 0;
+    }
+
+    memcpy(map, header, header_size);
+
+    render_job job = {0};
+    job.tracks = tracks;
+    job.fmt = *fmt;
+    job.frame_bytes = frame_bytes;
+    job.frames = frames;
+    job.num_chunks = (frames + RENDER_CHUNK_FRAMES - 1) / RENDER_CHUNK_FRAMES;
+    job.samples = map + header_size;
+
+    if (num_threads == 0)
+        num_threads = (u32)MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+    num_threads = (u32)MIN(num_threads, MIN(job.num_chunks, RENDER_MAX_THREADS));
+
+    // The calling thread is worker 0
+    pthread_t threads[RENDER_MAX_THREADS];
+    u32 started = 0;
+    for (u32 t = 1; t < num_threads; t++)
+    {
+        if (pthread_create(&threads[started], NULL, render_worker, &job) != 0)
+            break;
+        started++;
+    }
+    render_worker(&job);
+    for (u32 t = 0; t < started; t++)
+        pthread_join(threads[t], NULL);
+
+    b32 ok = !job.failed;
+    ok &= munmap(map, file_size) == 0;
+    ok &= close(fd) == 0;
+    return ok;
+}
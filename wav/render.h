@@ -0,0 +1,19 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "synth.h"
+
+// Frames handed to a worker at a time, big enough to amortize the queue and
+// small enough to balance notes of very different density
+#define RENDER_CHUNK_FRAMES (1u << 16)
+
+// Renders one synth per channel (fmt->channels of them) into a file of fmt at
+// path.
+// The timeline is split into chunks that worker threads render concurrently
+// straight into a shared mapping of the output file, every voice computes its
+// own phase at the chunk start so no chunk depends on the previous one.
+// num_threads 0 uses every online core. Returns 0 on failure.
+b32 render_parallel(const synth* tracks, const wav_format* fmt, const char* path,
+                    u32 num_threads);
+
+#endif
@@ -0,0 +1,213 @@
+#include "resample.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// inline max and min of two numbers
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+// Kaiser window shape, ~80 dB of stop band attenuation
+#define RESAMPLE_KAISER_BETA 8.0
+// Pass band edge as a fraction of the lower Nyquist frequency
+#define RESAMPLE_ROLLOFF 0.9
+
+// *** Filter design *** //
+
+static u32 gcd(u32 a, u32 b)
+{
+    while (b)
+    {
+        u32 t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Zeroth order modified Bessel function, series converges in ~20 terms
+static double bessel_i0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for (u32 k = 1; k < 32; k++)
+    {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// Windowed sinc prototype at the up-sampled rate, split into up branches of
+// RESAMPLE_TAPS. Branch p tap j multiplies the input j samples before the
+// newest one, stored reversed so the dot product walks forward in memory
+static void design_filter(resampler* rs)
+{
+    u32 up = rs->up;
+    u32 len = up * RESAMPLE_TAPS;
+    // Integer center so the delay init() compensates is exact
+    double center = (double)((len - 1) / 2);
+    double cutoff = 0.5 * RESAMPLE_ROLLOFF / MAX(rs->up, rs->down);
+    double norm = bessel_i0(RESAMPLE_KAISER_BETA);
+
+    for (u32 k = 0; k < len; k++)
+    {
+        double x = k - center;
+        double sinc = x == 0.0 ? 1.0 : sin(2.0 * M_PI * cutoff * x) /
+                                           (2.0 * M_PI * cutoff * x);
+        double r = x / (center + 1.0);
+        double window =
+            bessel_i0(RESAMPLE_KAISER_BETA * sqrt(MAX(0.0, 1.0 - r * r))) /
+            norm;
+        // times up to make up for the energy zero stuffing would remove
+        double h = 2.0 * cutoff * sinc * window * up;
+
+        u32 p = k % up;
+        u32 j = k / up;
+        rs->coefs[p * RESAMPLE_TAPS + (RESAMPLE_TAPS - 1 - j)] = (f32)h;
+    }
+
+    // Every branch gets exactly unity gain at DC, otherwise the truncated
+    // sinc leaves a per branch gain error that shows up as a tone at the
+    // branch cycle rate
+    for (u32 p = 0; p < up; p++)
+    {
+        f32* branch = &rs->coefs[p * RESAMPLE_TAPS];
+        double sum = 0.0;
+        for (u32 j = 0; j < RESAMPLE_TAPS; j++)
+            sum += branch[j];
+        for (u32 j = 0; j < RESAMPLE_TAPS; j++)
+            branch[j] = (f32)(branch[j] / sum);
+    }
+}
+
+b32 resampler_init(resampler* rs, u32 in_rate, u32 out_rate)
+{
+    memset(rs, 0, sizeof(*rs));
+    if (in_rate == 0 || out_rate == 0)
+        return 0;
+
+    u32 g = gcd(in_rate, out_rate);
+    rs->in_rate = in_rate;
+    rs->out_rate = out_rate;
+    rs->up = out_rate / g;
+    rs->down = in_rate / g;
+
+    if ((u64)rs->up * RESAMPLE_TAPS > RESAMPLE_MAX_COEFS)
+        return 0;
+
+    if (posix_memalign((void**)&rs->coefs, 16,
+                       sizeof(f32) * rs->up * RESAMPLE_TAPS) != 0)
+        return 0;
+    rs->buf = calloc(RESAMPLE_TAPS - 1 + RESAMPLE_BLOCK, sizeof(f32));
+    if (!rs->buf)
+    {
+        free(rs->coefs);
+        return 0;
+    }
+    design_filter(rs);
+
+    // History starts as silence, the first output is moved forward by the
+    // filter delay so the output lines up with the input
+    u32 delay = (rs->up * RESAMPLE_TAPS - 1) / 2;
+    rs->buf_len = RESAMPLE_TAPS - 1;
+    rs->pos = RESAMPLE_TAPS - 1 + delay / rs->up;
+    rs->phase = delay % rs->up;
+    return 1;
+}
+
+void resampler_free(resampler* rs)
+{
+    free(rs->coefs);
+    free(rs->buf);
+    memset(rs, 0, sizeof(*rs));
+}
+
+u64 resampler_max_output(const resampler* rs, u64 count)
+{
+    return (count * rs->up + rs->down - 1) / rs->down + 1;
+}
+
+// *** Filtering *** //
+
+static inline f32 dot(const f32* coefs, const f32* x)
+{
+    u32 i = 0;
+    f32 sum = 0.0f;
+
+#if defined(__SSE2__)
+    // Two accumulators hide the add latency
+    __m128 a0 = _mm_setzero_ps();
+    __m128 a1 = _mm_setzero_ps();
+    for (; i + 8 <= RESAMPLE_TAPS; i += 8)
+    {
+        a0 = _mm_add_ps(a0, _mm_mul_ps(_mm_load_ps(&coefs[i]),
+                                       _mm_loadu_ps(&x[i])));
+        a1 = _mm_add_ps(a1, _mm_mul_ps(_mm_load_ps(&coefs[i + 4]),
+                                       _mm_loadu_ps(&x[i + 4])));
+    }
+    a0 = _mm_add_ps(a0, a1);
+    a0 = _mm_add_ps(a0, _mm_movehl_ps(a0, a0));
+    a0 = _mm_add_ss(a0, _mm_shuffle_ps(a0, a0, 1));
+    sum = _mm_cvtss_f32(a0);
+#endif
+
+    for (; i < RESAMPLE_TAPS; i++)
+        sum += coefs[i] * x[i];
+    return sum;
+}
+
+// Feeds count samples and writes at most limit outputs
+static u64 resample_run(resampler* rs, const f32* in, u64 count, f32* out,
+                        u64 limit)
+{
+    u64 written = 0;
+
+    while (count > 0)
+    {
+        u32 n = (u32)MIN(count, RESAMPLE_BLOCK);
+        memcpy(&rs->buf[rs->buf_len], in, sizeof(f32) * n);
+        rs->buf_len += n;
+        in += n;
+        count -= n;
+
+        while (rs->pos < rs->buf_len && written < limit)
+        {
+            const f32* branch = &rs->coefs[rs->phase * RESAMPLE_TAPS];
+            out[written++] = dot(branch, &rs->buf[rs->pos - (RESAMPLE_TAPS - 1)]);
+
+            rs->phase += rs->down;
+            rs->pos += rs->phase / rs->up;
+            rs->phase %= rs->up;
+        }
+
+        // Keep the taps the next output still needs
+        u32 drop = MIN(rs->pos - (RESAMPLE_TAPS - 1), rs->buf_len);
+        memmove(rs->buf, &rs->buf[drop], sizeof(f32) * (rs->buf_len - drop));
+        rs->buf_len -= drop;
+        rs->pos -= drop;
+    }
+
+    rs->out_total += written;
+    return written;
+}
+
+u64 resampler_process(resampler* rs, const f32* in, u64 count, f32* out)
+{
+    rs->in_total += count;
+    return resample_run(rs, in, count, out, UINT64_MAX);
+}
+
+u64 resampler_flush(resampler* rs, f32* out)
+{
+    static const f32 silence[RESAMPLE_TAPS] = {0};
+    u64 expected = rs->in_total * rs->up / rs->down;
+    if (rs->out_total >= expected)
+        return 0;
+    // The filter delay is under RESAMPLE_TAPS input samples
+    return resample_run(rs, silence, RESAMPLE_TAPS, out,
+                        expected - rs->out_total);
+}
@@ -0,0 +1,52 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include "wav.h"
+
+// Taps per polyphase branch, multiple of 4 for the SIMD dot product
+#define RESAMPLE_TAPS 64
+// Input samples consumed per internal pass, bounds the working buffer
+#define RESAMPLE_BLOCK 1024
+// Largest coefficient table (up * RESAMPLE_TAPS) we are willing to build
+#define RESAMPLE_MAX_COEFS (1u << 20)
+
+// Polyphase FIR resampler for one channel.
+// The rate ratio is reduced to up/down, output n sits at n * down on the
+// up-sampled time line and only the branch of the prototype filter that
+// lands on input samples is evaluated, so nothing is ever zero stuffed.
+// Memory is the coefficient table plus RESAMPLE_TAPS + RESAMPLE_BLOCK floats
+// of history no matter how long the stream is.
+typedef struct
+{
+    u32 in_rate;
+    u32 out_rate;
+    u32 up;
+    u32 down;
+
+    f32* coefs; // up branches of RESAMPLE_TAPS, reversed for a forward dot
+
+    f32* buf;    // RESAMPLE_TAPS - 1 samples of history followed by input
+    u32 buf_len; // valid samples in buf
+    u32 pos;     // buf index of the newest tap of the next output
+    u32 phase;   // branch of the next output
+
+    u64 in_total;  // input samples consumed
+    u64 out_total; // output samples produced
+} resampler;
+
+// Returns 0 if the ratio needs a table bigger than RESAMPLE_MAX_COEFS
+b32 resampler_init(resampler* rs, u32 in_rate, u32 out_rate);
+void resampler_free(resampler* rs);
+
+// Most output samples count input samples can produce
+u64 resampler_max_output(const resampler* rs, u64 count);
+
+// Consumes every input sample, returns the number of samples written to out
+// which must hold resampler_max_output(rs, count)
+u64 resampler_process(resampler* rs, const f32* in, u64 count, f32* out);
+
+// Drains the filter delay at the end of the stream so the output holds
+// in_total * out_rate / in_rate samples, returns the samples written
+u64 resampler_flush(resampler* rs, f32* out);
+
+#endif
@@ -0,0 +1,237 @@
+#include "synth.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// inline max and min of two numbers
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+// Taylor coefficients of sin(2 * pi * x), good to ~6e-6 on [-0.25, 0.25]
+// which is well under one 16 bit step
+#define SIN_C1 6.28318531f
+#define SIN_C3 -41.3417022f
+#define SIN_C5 81.6052493f
+#define SIN_C7 -76.7058597f
+#define SIN_C9 42.0586940f
+#define SIN_C11 -15.0946426f
+
+// Phase is kept as a u32 fraction of a turn, so it wraps for free
+#define PHASE_TO_TURNS (1.0f / 4294967296.0f)
+
+// *** Setup *** //
+
+void synth_init(synth* s, u32 sample_rate, synth_envelope env)
+{
+    memset(s, 0, sizeof(*s));
+    s->sample_rate = sample_rate;
+    s->env = env;
+}
+
+void synth_free(synth* s)
+{
+    free(s->voices);
+    memset(s, 0, sizeof(*s));
+}
+
+b32 synth_add_note(synth* s, f32 start, f32 dur, f32 freq, f32 amp)
+{
+    if (s->num_voices == s->cap_voices)
+    {
+        u32 cap = s->cap_voices ? s->cap_voices * 2 : 64;
+        synth_voice* voices = realloc(s->voices, sizeof(synth_voice) * cap);
+        if (!voices)
+            return 0;
+        s->voices = voices;
+        s->cap_voices = cap;
+    }
+
+    synth_voice v;
+    v.start = (u64)((double)start * s->sample_rate);
+    v.length = (u64)((double)(dur + s->env.release) * s->sample_rate);
+    v.phase_inc = (u32)((double)freq / s->sample_rate * 4294967296.0);
+    v.amp = amp;
+
+    // Sequencers append in time order so this is normally a plain push
+    u32 at = s->num_voices;
+    while (at > 0 && s->voices[at - 1].start > v.start)
+        at--;
+    memmove(&s->voices[at + 1], &s->voices[at],
+            sizeof(synth_voice) * (s->num_voices - at));
+    s->voices[at] = v;
+    s->num_voices++;
+
+    s->max_length = MAX(s->max_length, v.length);
+    s->length = MAX(s->length, v.start + v.length);
+    return 1;
+}
+
+// *** Oscillator *** //
+
+// sin(2 * pi * x) for x in [-0.5, 0.5), folded onto [-0.25, 0.25]
+static inline f32 sin_turns(f32 x)
+{
+    if (x > 0.25f)
+        x = 0.5f - x;
+    else if (x < -0.25f)
+        x = -0.5f - x;
+    f32 x2 = x * x;
+    return x *
+           (SIN_C1 +
+            x2 * (SIN_C3 +
+                  x2 * (SIN_C5 + x2 * (SIN_C7 + x2 * (SIN_C9 + x2 * SIN_C11)))));
+}
+
+// Per voice envelope constants, in samples
+typedef struct
+{
+    f32 inv_attack;
+    f32 attack;
+    f32 decay_slope;
+    f32 sustain;
+    f32 inv_release;
+    f32 length;
+} envelope_k;
+
+static envelope_k envelope_constants(const synth* s, const synth_voice* v)
+{
+    envelope_k k;
+    f32 rate = (f32)s->sample_rate;
+    f32 attack = s->env.attack * rate;
+    f32 decay = s->env.decay * rate;
+    f32 release = s->env.release * rate;
+
+    // A zero length stage becomes a step instead of a division by zero
+    k.inv_attack = attack > 0.0f ? 1.0f / attack : 1e30f;
+    k.attack = attack;
+    k.decay_slope = decay > 0.0f ? (1.0f - s->env.sustain) / decay : 1e30f;
+    k.sustain = s->env.sustain;
+    k.inv_release = release > 0.0f ? 1.0f / release : 1e30f;
+    k.length = (f32)v->length;
+    return k;
+}
+
+// min(attack ramp, max(sustain, decay ramp)) * release ramp, all stages are
+// linear so it is branch free
+static inline f32 envelope_at(const envelope_k* k, f32 n)
+{
+    f32 ad = MIN(n * k->inv_attack,
+                 MAX(k->sustain, 1.0f - (n - k->attack) * k->decay_slope));
+    f32 r = MIN((k->length - n) * k->inv_release, 1.0f);
+    return ad * MAX(r, 0.0f);
+}
+
+// Adds count samples of voice v starting at its local sample n0
+static void render_voice(const synth* s, const synth_voice* v, u64 n0, f32* out,
+                         u32 count)
+{
+    envelope_k k = envelope_constants(s, v);
+    u32 inc = v->phase_inc;
+    u32 phase = inc * (u32)n0;
+    f32 n = (f32)n0;
+    u32 i = 0;
+
+#if defined(__SSE2__)
+    __m128i ph = _mm_setr_epi32((i32)phase, (i32)(phase + inc),
+                                (i32)(phase + 2 * inc), (i32)(phase + 3 * inc));
+    __m128i ph_step = _mm_set1_epi32((i32)(inc * 4));
+    __m128 nv = _mm_setr_ps(n, n + 1.0f, n + 2.0f, n + 3.0f);
+    __m128 n_step = _mm_set1_ps(4.0f);
+
+    const __m128 to_turns = _mm_set1_ps(PHASE_TO_TURNS);
+    const __m128 quarter = _mm_set1_ps(0.25f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 sign_mask = _mm_set1_ps(-0.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 amp = _mm_set1_ps(v->amp);
+    const __m128 inv_attack = _mm_set1_ps(k.inv_attack);
+    const __m128 attack = _mm_set1_ps(k.attack);
+    const __m128 decay_slope = _mm_set1_ps(k.decay_slope);
+    const __m128 sustain = _mm_set1_ps(k.sustain);
+    const __m128 inv_release = _mm_set1_ps(k.inv_release);
+    const __m128 length = _mm_set1_ps(k.length);
+
+    for (; i + 4 <= count; i += 4)
+    {
+        // Signed phase is the position in [-0.5, 0.5) turns
+        __m128 x = _mm_mul_ps(_mm_cvtepi32_ps(ph), to_turns);
+
+        // Fold |x| > 0.25 back onto the rising part of the wave
+        __m128 sign = _mm_and_ps(x, sign_mask);
+        __m128 fold = _mm_cmpgt_ps(_mm_andnot_ps(sign_mask, x), quarter);
+        __m128 folded = _mm_sub_ps(_mm_or_ps(half, sign), x);
+        x = _mm_or_ps(_mm_and_ps(fold, folded), _mm_andnot_ps(fold, x));
+
+        __m128 x2 = _mm_mul_ps(x, x);
+        __m128 p = _mm_set1_ps(SIN_C11);
+        p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(SIN_C9));
+        p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(SIN_C7));
+        p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(SIN_C5));
+        p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(SIN_C3));
+        p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(SIN_C1));
+        __m128 y = _mm_mul_ps(p, x);
+
+        __m128 decay =
+            _mm_sub_ps(one, _mm_mul_ps(_mm_sub_ps(nv, attack), decay_slope));
+        __m128 ad = _mm_min_ps(_mm_mul_ps(nv, inv_attack),
+                               _mm_max_ps(sustain, decay));
+        __m128 r = _mm_min_ps(_mm_mul_ps(_mm_sub_ps(length, nv), inv_release),
+                              one);
+        __m128 env = _mm_mul_ps(ad, _mm_max_ps(r, zero));
+
+        __m128 acc = _mm_loadu_ps(&out[i]);
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_mul_ps(y, env), amp));
+        _mm_storeu_ps(&out[i], acc);
+
+        ph = _mm_add_epi32(ph, ph_step);
+        nv = _mm_add_ps(nv, n_step);
+    }
+    phase += inc * i;
+    n += (f32)i;
+#endif
+
+    for (; i < count; i++)
+    {
+        f32 x = (f32)(i32)phase * PHASE_TO_TURNS;
+        out[i] += sin_turns(x) * envelope_at(&k, n) * v->amp;
+        phase += inc;
+        n += 1.0f;
+    }
+}
+
+// *** Mixer *** //
+
+void synth_render(const synth* s, u64 pos, f32* out, u32 frames)
+{
+    memset(out, 0, sizeof(f32) * frames);
+
+    u64 end = pos + frames;
+    // Voices are sorted by start, anything starting before pos - max_length
+    // has already finished
+    u64 earliest = pos > s->max_length ? pos - s->max_length : 0;
+    u32 lo = 0, hi = s->num_voices;
+    while (lo < hi)
+    {
+        u32 mid = lo + (hi - lo) / 2;
+        if (s->voices[mid].start < earliest)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (u32 i = lo; i < s->num_voices && s->voices[i].start < end; i++)
+    {
+        const synth_voice* v = &s->voices[i];
+        u64 v_end = v->start + v->length;
+        if (v_end <= pos)
+            continue;
+
+        u64 from = MAX(pos, v->start);
+        u64 to = MIN(end, v_end);
+        render_voice(s, v, from - v->start, &out[from - pos], (u32)(to - from));
+    }
+}
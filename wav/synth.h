@@ -0,0 +1,53 @@
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include "wav.h"
+
+// Samples processed per inner block, also the granularity of synth_render
+// callers should use to keep the mix buffer in L1
+#define SYNTH_BLOCK 256
+
+// *** Envelope *** //
+// ADSR, times in seconds and sustain as a level between [0-1]
+typedef struct
+{
+    f32 attack;
+    f32 decay;
+    f32 sustain;
+    f32 release;
+} synth_envelope;
+
+// *** Voices *** //
+// One note, the phase at any sample is phase_inc * (n - start) so a voice can
+// be rendered from any position without running the samples before it
+typedef struct
+{
+    u64 start;     // first sample
+    u64 length;    // samples, release included
+    u32 phase_inc; // frequency as a fraction of the sample rate times 2^32
+    f32 amp;
+} synth_voice;
+
+typedef struct
+{
+    u32 sample_rate;
+    synth_envelope env;
+
+    synth_voice* voices; // sorted by start
+    u32 num_voices;
+    u32 cap_voices;
+    u64 max_length; // longest voice, bounds the lookup of active voices
+
+    u64 length; // samples until the last voice ends
+} synth;
+
+void synth_init(synth* s, u32 sample_rate, synth_envelope env);
+void synth_free(synth* s);
+
+// Schedules a note, returns 0 if it could not be allocated
+b32 synth_add_note(synth* s, f32 start, f32 dur, f32 freq, f32 amp);
+
+// Mixes every voice sounding in [pos, pos + frames) into out (overwritten)
+void synth_render(const synth* s, u64 pos, f32* out, u32 frames);
+
+#endif
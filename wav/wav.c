@@ -0,0 +1,679 @@
+#if defined(__linux__) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include "wav.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// inline max and min of two numbers
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+// RIFF sizes are 32 bit, anything past that can't be described by the header
+#define WAV_MAX_DATA_SIZE (UINT32_MAX - WAV_HEADER_MAX_SIZE + 8)
+
+// *** Little endian helpers *** //
+
+static void put_le16(u8* p, u16 n)
+{
+    p[0] = (u8)n;
+    p[1] = (u8)(n >> 8);
+}
+
+static void put_le32(u8* p, u32 n)
+{
+    p[0] = (u8)n;
+    p[1] = (u8)(n >> 8);
+    p[2] = (u8)(n >> 16);
+    p[3] = (u8)(n >> 24);
+}
+
+static u16 get_le16(const u8* p)
+{
+    return (u16)(p[0] | (p[1] << 8));
+}
+
+static u32 get_le32(const u8* p)
+{
+    return (u32)p[0] | ((u32)p[1] << 8) | ((u32)p[2] << 16) |
+           ((u32)p[3] << 24);
+}
+
+// write() can return early on pipes/signals, keep going until everything is out
+static b32 write_all(int fd, const u8* p, u64 len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        p += n;
+        len -= (u64)n;
+    }
+    return 1;
+}
+
+static b32 pwrite_all(int fd, const u8* p, u64 len, u64 off)
+{
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, p, len, (off_t)off);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+        p += n;
+        len -= (u64)n;
+        off += (u64)n;
+    }
+    return 1;
+}
+
+// *** Formats *** //
+
+// KSDATAFORMAT_SUBTYPE_* GUIDs are the format tag followed by these 14 bytes
+static const u8 s_guid_tail[14] = {0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80,
+                                   0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71};
+
+// Default speaker layouts for 1 to 8 channels (mono, stereo, 2.1/3.0, quad,
+// 5.0, 5.1, 6.1, 7.1)
+static const u32 s_channel_masks[9] = {0,     0x4,   0x3,   0x7,  0x33,
+                                       0x37,  0x3F,  0x70F, 0x63F};
+
+wav_format wav_format_make(u32 sample_rate, u16 channels, wav_sample_type type)
+{
+    wav_format fmt;
+    fmt.sample_rate = sample_rate;
+    fmt.channels = channels;
+    fmt.type = type;
+    fmt.extensible = channels > 2 || type != WAV_PCM16;
+    fmt.channel_mask = channels <= 8 ? s_channel_masks[channels] : 0;
+    return fmt;
+}
+
+u16 wav_format_sample_bytes(const wav_format* fmt)
+{
+    switch (fmt->type)
+    {
+    case WAV_PCM24:
+        return 3;
+    case WAV_FLOAT32:
+        return 4;
+    default:
+        return 2;
+    }
+}
+
+// *** Header *** //
+
+// PCM: RIFF, fmt (16), data
+// Float: RIFF, fmt (18), fact, data
+// Extensible: RIFF, fmt (40), [fact], data
+u32 wav_header_build(u8 out[WAV_HEADER_MAX_SIZE], const wav_format* fmt,
+                     u64 data_size)
+{
+    u16 sample_bytes = wav_format_sample_bytes(fmt);
+    u16 block_align = fmt->channels * sample_bytes;
+    u16 tag = fmt->type == WAV_FLOAT32 ? WAV_FORMAT_FLOAT : WAV_FORMAT_PCM;
+    // Anything that isn't integer PCM needs a fact chunk with the frame count
+    b32 fact = tag != WAV_FORMAT_PCM;
+    u32 fmt_size = fmt->extensible ? 40 : (fact ? 18 : 16);
+    u32 size = (u32)MIN(data_size, WAV_MAX_DATA_SIZE);
+
+    u32 header_size = 12 + 8 + fmt_size + (fact ? 12 : 0) + 8;
+    u32 p = 0;
+
+    // FileTypeBlocID - Identifier
+    memcpy(&out[p], "RIFF", 4);
+    // FileSize - Overall file size minus 8 bytes, counting the pad byte that
+    // keeps an odd sized data chunk word aligned
+    put_le32(&out[p + 4], size + (size & 1) + header_size - 8);
+    // FileFormatID - Format
+    memcpy(&out[p + 8], "WAVE", 4);
+    p += 12;
+
+    // *** Describes the data format *** ///
+    // FormatBlocID - Identifier
+    memcpy(&out[p], "fmt ", 4);
+    // BlocSize
+    put_le32(&out[p + 4], fmt_size);
+    // AudioFormat - PCM Integer, IEEE float or extensible
+    put_le16(&out[p + 8], fmt->extensible ? WAV_FORMAT_EXTENSIBLE : tag);
+    // Number of channels
+    put_le16(&out[p + 10], fmt->channels);
+    // Sample rate
+    put_le32(&out[p + 12], fmt->sample_rate);
+    // BytePerSec - Frequency * BytePerBloc
+    put_le32(&out[p + 16], fmt->sample_rate * block_align);
+    // BytePerBloc - Channels * BitsPerSample / 8
+    put_le16(&out[p + 20], block_align);
+    // BitsPerSample
+    put_le16(&out[p + 22], sample_bytes * 8);
+    if (fmt_size > 16)
+    {
+        // cbSize - bytes of extension that follow
+        put_le16(&out[p + 24], (u16)(fmt_size - 18));
+    }
+    if (fmt->extensible)
+    {
+        // ValidBitsPerSample, ChannelMask, SubFormat GUID
+        put_le16(&out[p + 26], sample_bytes * 8);
+        put_le32(&out[p + 28], fmt->channel_mask);
+        put_le16(&out[p + 32], tag);
+        memcpy(&out[p + 34], s_guid_tail, sizeof(s_guid_tail));
+    }
+    p += 8 + fmt_size;
+
+    if (fact)
+    {
+        // SampleLength - frames per channel
+        memcpy(&out[p], "fact", 4);
+        put_le32(&out[p + 4], 4);
+        put_le32(&out[p + 8], block_align ? size / block_align : 0);
+        p += 12;
+    }
+
+    // *** Chunk Containing the sampled data *** //
+    // DataBlocID
+    memcpy(&out[p], "data", 4);
+    // DataSize
+    put_le32(&out[p + 4], size);
+
+    return header_size;
+}
+
+// *** Conversion *** //
+
+void wav_f32_to_i16(const f32* in, i16* out, u64 count)
+{
+    u64 i = 0;
+
+#if defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps((f32)INT16_MAX);
+    // cvtps turns anything past i32 range into INT32_MIN, clamp first so
+    // large positive values don't wrap to -32768
+    const __m128 lo_lim = _mm_set1_ps((f32)INT16_MIN);
+    const __m128 hi_lim = _mm_set1_ps((f32)INT16_MAX);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(&in[i]), scale);
+        __m128 b = _mm_mul_ps(_mm_loadu_ps(&in[i + 4]), scale);
+        a = _mm_min_ps(_mm_max_ps(a, lo_lim), hi_lim);
+        b = _mm_min_ps(_mm_max_ps(b, lo_lim), hi_lim);
+        // cvtps rounds to nearest, packs saturates to [-32768, 32767]
+        __m128i lo = _mm_cvtps_epi32(a);
+        __m128i hi = _mm_cvtps_epi32(b);
+        _mm_storeu_si128((__m128i*)&out[i], _mm_packs_epi32(lo, hi));
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        f32 y = in[i] * (f32)INT16_MAX;
+        y = MIN(MAX(y, (f32)INT16_MIN), (f32)INT16_MAX);
+        out[i] = (i16)lrintf(y);
+    }
+}
+
+// 24 bit samples are kept in an i32 until they get packed into 3 bytes
+static void wav_f32_to_i24(const f32* in, i32* out, u64 count)
+{
+    u64 i = 0;
+
+#if defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(8388607.0f);
+    const __m128 lo_lim = _mm_set1_ps(-8388608.0f);
+    const __m128 hi_lim = _mm_set1_ps(8388607.0f);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(&in[i]), scale);
+        a = _mm_min_ps(_mm_max_ps(a, lo_lim), hi_lim);
+        _mm_storeu_si128((__m128i*)&out[i], _mm_cvtps_epi32(a));
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        f32 y = in[i] * 8388607.0f;
+        y = MIN(MAX(y, -8388608.0f), 8388607.0f);
+        out[i] = (i32)lrintf(y);
+    }
+}
+
+// Stereo gets a SIMD unpack, mono is a straight copy, anything else strides
+static void interleave_i16(const i16* const* src, u16 channels, u32 frames,
+                           i16* dst)
+{
+    u32 i = 0;
+    if (channels == 1)
+    {
+        memcpy(dst, src[0], sizeof(i16) * frames);
+        return;
+    }
+    if (channels == 2)
+    {
+#if defined(__SSE2__)
+        for (; i + 8 <= frames; i += 8)
+        {
+            __m128i l = _mm_loadu_si128((const __m128i*)&src[0][i]);
+            __m128i r = _mm_loadu_si128((const __m128i*)&src[1][i]);
+            _mm_storeu_si128((__m128i*)&dst[2 * i], _mm_unpacklo_epi16(l, r));
+            _mm_storeu_si128((__m128i*)&dst[2 * i + 8],
+                             _mm_unpackhi_epi16(l, r));
+        }
+#endif
+    }
+    for (u16 c = 0; c < channels; c++)
+        for (u32 j = i; j < frames; j++)
+            dst[j * channels + c] = src[c][j];
+}
+
+static void interleave_f32(const f32* const* src, u16 channels, u32 frames,
+                           f32* dst)
+{
+    u32 i = 0;
+    if (channels == 1)
+    {
+        memcpy(dst, src[0], sizeof(f32) * frames);
+        return;
+    }
+    if (channels == 2)
+    {
+#if defined(__SSE2__)
+        for (; i + 4 <= frames; i += 4)
+        {
+            __m128 l = _mm_loadu_ps(&src[0][i]);
+            __m128 r = _mm_loadu_ps(&src[1][i]);
+            _mm_storeu_ps(&dst[2 * i], _mm_unpacklo_ps(l, r));
+            _mm_storeu_ps(&dst[2 * i + 4], _mm_unpackhi_ps(l, r));
+        }
+#endif
+    }
+    for (u16 c = 0; c < channels; c++)
+        for (u32 j = i; j < frames; j++)
+            dst[j * channels + c] = src[c][j];
+}
+
+void wav_interleave_f32(const wav_format* fmt, const f32* const* planes,
+                        u64 frames, u8* dst)
+{
+    u16 channels = fmt->channels;
+    u16 frame_bytes = channels * wav_format_sample_bytes(fmt);
+
+    // Per channel converted block, small enough to stay in L1
+    i16 tmp16[2][WAV_CONVERT_BLOCK];
+    i32 tmp24[WAV_CONVERT_BLOCK];
+    const i16* rows16[2] = {tmp16[0], tmp16[1]};
+
+    for (u64 pos = 0; pos < frames; pos += WAV_CONVERT_BLOCK)
+    {
+        u32 n = (u32)MIN(WAV_CONVERT_BLOCK, frames - pos);
+        u8* out = dst + pos * frame_bytes;
+
+        switch (fmt->type)
+        {
+        case WAV_PCM16:
+            if (channels <= 2)
+            {
+                for (u16 c = 0; c < channels; c++)
+                    wav_f32_to_i16(&planes[c][pos], tmp16[c], n);
+                interleave_i16(rows16, channels, n, (i16*)out);
+                break;
+            }
+            for (u16 c = 0; c < channels; c++)
+            {
+                wav_f32_to_i16(&planes[c][pos], tmp16[0], n);
+                i16* s = (i16*)out + c;
+                for (u32 i = 0; i < n; i++)
+                    s[i * channels] = tmp16[0][i];
+            }
+            break;
+        case WAV_PCM24:
+            for (u16 c = 0; c < channels; c++)
+            {
+                wav_f32_to_i24(&planes[c][pos], tmp24, n);
+                u8* s = out + c * 3;
+                for (u32 i = 0; i < n; i++, s += frame_bytes)
+                {
+                    s[0] = (u8)tmp24[i];
+                    s[1] = (u8)(tmp24[i] >> 8);
+                    s[2] = (u8)(tmp24[i] >> 16);
+                }
+            }
+            break;
+        case WAV_FLOAT32:
+        {
+            // Planes are offset to this block so the helper sees frame 0
+            const f32* rows[2];
+            if (channels <= 2)
+            {
+                for (u16 c = 0; c < channels; c++)
+                    rows[c] = &planes[c][pos];
+                interleave_f32(rows, channels, n, (f32*)out);
+                break;
+            }
+            for (u16 c = 0; c < channels; c++)
+            {
+                f32* s = (f32*)out + c;
+                for (u32 i = 0; i < n; i++)
+                    s[i * channels] = planes[c][pos + i];
+            }
+            break;
+        }
+        }
+    }
+}
+
+// *** Streaming writer *** //
+
+static b32 wav_writer_flush(wav_writer* w)
+{
+    if (w->buf_len == 0)
+        return 1;
+    if (!write_all(w->fd, w->buf, w->buf_len))
+        w->failed = 1;
+    w->buf_len = 0;
+    return !w->failed;
+}
+
+wav_writer* wav_writer_open_format(const char* path, const wav_format* fmt)
+{
+    if (fmt->channels == 0)
+        return NULL;
+
+    wav_writer* w = calloc(1, sizeof(wav_writer));
+    if (!w)
+        return NULL;
+
+    if (posix_memalign((void**)&w->buf, WAV_WRITER_BUF_ALIGN,
+                       WAV_WRITER_BUF_SIZE) != 0)
+    {
+        free(w);
+        return NULL;
+    }
+
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->fd == -1)
+    {
+        free(w->buf);
+        free(w);
+        return NULL;
+    }
+
+    w->fmt = *fmt;
+    w->frame_bytes = fmt->channels * wav_format_sample_bytes(fmt);
+
+    // Sizes are unknown until close, the header goes out with the first batch
+    // and gets patched in place
+    w->header_size = wav_header_build(w->buf, fmt, 0);
+    w->buf_len = w->header_size;
+
+    return w;
+}
+
+wav_writer* wav_writer_open(const char* path, u32 sample_rate, u16 channels)
+{
+    wav_format fmt = wav_format_make(sample_rate, channels, WAV_PCM16);
+    return wav_writer_open_format(path, &fmt);
+}
+
+// Samples are stored in host order, like the rest of this project we only
+// target little endian machines
+b32 wav_writer_append_i16(wav_writer* w, const i16* frames, u64 frame_count)
+{
+    if (w->fmt.type != WAV_PCM16)
+        return 0;
+
+    const u8* src = (const u8*)frames;
+    u64 len = frame_count * w->frame_bytes;
+    w->data_size += len;
+
+    while (len > 0)
+    {
+        // Big blocks skip the copy when the staging buffer is empty
+        if (w->buf_len == 0 && len >= WAV_WRITER_BUF_SIZE)
+        {
+            u64 direct = len - len % WAV_WRITER_BUF_SIZE;
+            if (!write_all(w->fd, src, direct))
+                w->failed = 1;
+            src += direct;
+            len -= direct;
+            continue;
+        }
+
+        u64 n = MIN(len, WAV_WRITER_BUF_SIZE - w->buf_len);
+        memcpy(&w->buf[w->buf_len], src, n);
+        w->buf_len += n;
+        src += n;
+        len -= n;
+
+        if (w->buf_len == WAV_WRITER_BUF_SIZE)
+            wav_writer_flush(w);
+    }
+
+    return !w->failed;
+}
+
+b32 wav_writer_append_f32(wav_writer* w, const f32* const* planes,
+                          u64 frame_count)
+{
+    u16 channels = w->fmt.channels;
+    const f32* offset[channels];
+
+    // Converted frames land in the staging buffer directly, as many as fit
+    u64 pos = 0;
+    while (pos < frame_count)
+    {
+        u64 n = MIN((WAV_WRITER_BUF_SIZE - w->buf_len) / w->frame_bytes,
+                    frame_count - pos);
+        if (n == 0)
+        {
+            wav_writer_flush(w);
+            continue;
+        }
+
+        for (u16 c = 0; c < channels; c++)
+            offset[c] = &planes[c][pos];
+        wav_interleave_f32(&w->fmt, offset, n, &w->buf[w->buf_len]);
+        w->buf_len += n * w->frame_bytes;
+        w->data_size += n * w->frame_bytes;
+        pos += n;
+    }
+
+    return !w->failed;
+}
+
+b32 wav_writer_close(wav_writer* w)
+{
+    wav_writer_flush(w);
+
+    u8 header[WAV_HEADER_MAX_SIZE];
+    wav_header_build(header, &w->fmt, w->data_size);
+    if (!pwrite_all(w->fd, header, w->header_size, 0))
+        w->failed = 1;
+    // RIFF wants chunks padded to an even size
+    if (w->data_size & 1)
+    {
+        u8 pad = 0;
+        if (!write_all(w->fd, &pad, 1))
+            w->failed = 1;
+    }
+    if (close(w->fd) != 0)
+        w->failed = 1;
+
+    b32 ok = !w->failed;
+    free(w->buf);
+    free(w);
+    return ok;
+}
+
+// *** Reader *** //
+
+// fmt chunk fields, offsets from the start of the chunk body
+static b32 wav_parse_fmt(wav_reader* r, const u8* fmt, u32 size)
+{
+    if (size < 16)
+        return 0;
+
+    r->format = get_le16(&fmt[0]);
+    r->channels = get_le16(&fmt[2]);
+    r->sample_rate = get_le32(&fmt[4]);
+    r->block_align = get_le16(&fmt[12]);
+    r->bits_per_sample = get_le16(&fmt[14]);
+
+    // Extensible keeps the real format in the first two bytes of the GUID
+    if (r->format == WAV_FORMAT_EXTENSIBLE)
+    {
+        if (size < 40)
+            return 0;
+        r->format = get_le16(&fmt[24]);
+    }
+
+    if (r->format != WAV_FORMAT_PCM && r->format != WAV_FORMAT_FLOAT)
+        return 0;
+    if (r->channels == 0 || r->bits_per_sample == 0 ||
+        r->bits_per_sample % 8 != 0)
+        return 0;
+    return r->block_align == r->channels * (r->bits_per_sample / 8);
+}
+
+b32 wav_reader_open(wav_reader* r, const char* path)
+{
+    memset(r, 0, sizeof(*r));
+
+    r->fd = open(path, O_RDONLY);
+    if (r->fd == -1)
+        return 0;
+
+    struct stat st;
+    if (fstat(r->fd, &st) != 0 || (u64)st.st_size < 12)
+        goto fail;
+    r->map_size = (u64)st.st_size;
+
+    void* map = mmap(NULL, r->map_size, PROT_READ, MAP_SHARED, r->fd, 0);
+    if (map == MAP_FAILED)
+        goto fail;
+    r->map = map;
+
+    if (memcmp(&r->map[0], "RIFF", 4) != 0 || memcmp(&r->map[8], "WAVE", 4))
+        goto fail;
+
+    // Walk the chunk list, anything that isn't fmt or data (LIST, fact...) is
+    // skipped
+    b32 have_fmt = 0;
+    u64 off = 12;
+    while (off + 8 <= r->map_size)
+    {
+        const u8* chunk = &r->map[off];
+        u64 size = get_le32(&chunk[4]);
+        u64 body = off + 8;
+
+        if (memcmp(chunk, "fmt ", 4) == 0)
+        {
+            if (body + size > r->map_size || !wav_parse_fmt(r, &r->map[body], size))
+                goto fail;
+            have_fmt = 1;
+        }
+        else if (memcmp(chunk, "data", 4) == 0)
+        {
+            if (!have_fmt)
+                goto fail;
+            // A writer that never patched its header leaves a zero or bogus
+            // size, the data then runs to the end of the file
+            if (size == 0 || body + size > r->map_size)
+                size = r->map_size - body;
+            r->data = &r->map[body];
+            r->frames = size / r->block_align;
+            r->data_size = r->frames * r->block_align;
+
+            madvise((void*)r->map, r->map_size, MADV_SEQUENTIAL);
+            return 1;
+        }
+
+        // chunks are padded to an even size
+        off = body + size + (size & 1);
+    }
+
+fail:
+    wav_reader_close(r);
+    return 0;
+}
+
+void wav_reader_close(wav_reader* r)
+{
+    if (r->map)
+        munmap((void*)r->map, r->map_size);
+    if (r->fd >= 0)
+        close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+// Only handed out when the data chunk is aligned for the type, otherwise the
+// caller has to go through the raw bytes
+const i16* wav_reader_i16(const wav_reader* r)
+{
+    if (r->format != WAV_FORMAT_PCM || r->bits_per_sample != 16 ||
+        (uintptr_t)r->data % sizeof(i16) != 0)
+        return NULL;
+    return (const i16*)r->data;
+}
+
+const f32* wav_reader_f32(const wav_reader* r)
+{
+    if (r->format != WAV_FORMAT_FLOAT || r->bits_per_sample != 32 ||
+        (uintptr_t)r->data % sizeof(f32) != 0)
+        return NULL;
+    return (const f32*)r->data;
+}
+
+void wav_iter_begin(wav_iter* it, const wav_reader* r, u64 window_frames)
+{
+    it->r = r;
+    it->window_frames = window_frames ? window_frames : 1;
+    it->pos = 0;
+    it->dropped = 0;
+}
+
+u64 wav_iter_next(wav_iter* it, const u8** frames)
+{
+    const wav_reader* r = it->r;
+    if (it->pos >= r->frames)
+        return 0;
+
+    u64 page = (u64)sysconf(_SC_PAGESIZE);
+    u64 count = MIN(it->window_frames, r->frames - it->pos);
+    u64 start = (u64)(r->data - r->map) + it->pos * r->block_align;
+    u64 end = start + count * r->block_align;
+
+    // Drop the pages the previous window used and prefetch this one
+    u64 done = start - start % page;
+    if (done > it->dropped)
+    {
+        madvise((void*)(r->map + it->dropped), done - it->dropped,
+                MADV_DONTNEED);
+        it->dropped = done;
+    }
+    madvise((void*)(r->map + done), end - done, MADV_WILLNEED);
+
+    *frames = r->map + start;
+    it->pos += count;
+    return count;
+}
@@ -0,0 +1,139 @@
+#ifndef WAV_H
+#define WAV_H
+
+#include <stdint.h>
+
+// *** Types *** //
+typedef int16_t i16;
+typedef int32_t i32;
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+typedef i32 b32;
+
+typedef float f32;
+
+// Format tags found in the fmt chunk
+#define WAV_FORMAT_PCM 1
+#define WAV_FORMAT_FLOAT 3
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
+// Canonical RIFF/WAVE header written in front of 16 bit PCM samples, other
+// formats add a fact chunk and/or the extensible fmt fields
+#define WAV_HEADER_SIZE 44
+#define WAV_HEADER_MAX_SIZE 80
+
+// Staging buffer size, samples are batched until it fills and then written
+// with a single syscall
+#define WAV_WRITER_BUF_SIZE (1u << 20)
+#define WAV_WRITER_BUF_ALIGN 4096
+
+// Frames converted per pass of wav_interleave_f32, keeps the per channel
+// temporaries in L1
+#define WAV_CONVERT_BLOCK 256
+
+// *** Formats *** //
+typedef enum
+{
+    WAV_PCM16,
+    WAV_PCM24,
+    WAV_FLOAT32,
+} wav_sample_type;
+
+typedef struct
+{
+    u32 sample_rate;
+    u16 channels;
+    wav_sample_type type;
+    b32 extensible;   // WAVE_FORMAT_EXTENSIBLE fmt chunk
+    u32 channel_mask; // speaker positions, extensible only
+} wav_format;
+
+// Format with the usual defaults, extensible when there are more than two
+// channels or more than 16 bits like Microsoft recommends
+wav_format wav_format_make(u32 sample_rate, u16 channels, wav_sample_type type);
+// Bytes of one sample of one channel
+u16 wav_format_sample_bytes(const wav_format* fmt);
+
+// Fills the header for data_size bytes of samples, returns its size
+u32 wav_header_build(u8 out[WAV_HEADER_MAX_SIZE], const wav_format* fmt,
+                     u64 data_size);
+
+// [-1, 1] floats to 16 bit PCM, rounded and saturated
+void wav_f32_to_i16(const f32* in, i16* out, u64 count);
+// Converts one plane per channel into interleaved frames of fmt in one pass
+void wav_interleave_f32(const wav_format* fmt, const f32* const* planes,
+                        u64 frames, u8* dst);
+
+// *** Streaming writer *** //
+typedef struct
+{
+    int fd;
+    wav_format fmt;
+    u32 header_size;
+    u16 frame_bytes;
+
+    u64 data_size; // bytes of sample data appended so far
+    b32 failed;    // a write failed, close will report it
+
+    u8* buf; // WAV_WRITER_BUF_ALIGN aligned staging buffer
+    u64 buf_len;
+} wav_writer;
+
+// Opens path and reserves the header, returns NULL on failure
+wav_writer* wav_writer_open_format(const char* path, const wav_format* fmt);
+// 16 bit PCM shorthand
+wav_writer* wav_writer_open(const char* path, u32 sample_rate, u16 channels);
+// Appends frame_count interleaved 16 bit frames, PCM16 writers only
+b32 wav_writer_append_i16(wav_writer* w, const i16* frames, u64 frame_count);
+// Converts and interleaves one float plane per channel straight into the
+// staging buffer
+b32 wav_writer_append_f32(wav_writer* w, const f32* const* planes,
+                          u64 frame_count);
+// Flushes the buffer, patches RIFF/data sizes and closes the file
+b32 wav_writer_close(wav_writer* w);
+
+// *** Reader *** //
+// Read only mapping of a whole file, samples are used in place
+typedef struct
+{
+    int fd;
+    const u8* map;
+    u64 map_size;
+
+    u16 format; // PCM or FLOAT, the sub format for EXTENSIBLE files
+    u16 channels;
+    u32 sample_rate;
+    u16 bits_per_sample;
+    u16 block_align; // bytes per frame
+
+    const u8* data; // first frame inside map
+    u64 data_size;
+    u64 frames;
+} wav_reader;
+
+// Sequential walk over a reader in windows of frames, pages behind the
+// window are dropped so resident memory stays bounded on files bigger than RAM
+typedef struct
+{
+    const wav_reader* r;
+    u64 window_frames;
+    u64 pos;     // next frame
+    u64 dropped; // map offset up to which pages were already released
+} wav_iter;
+
+// Maps path and validates the RIFF/WAVE, fmt and data chunks
+b32 wav_reader_open(wav_reader* r, const char* path);
+void wav_reader_close(wav_reader* r);
+
+// Typed views of the data chunk, NULL if the format doesn't match
+const i16* wav_reader_i16(const wav_reader* r);
+const f32* wav_reader_f32(const wav_reader* r);
+
+void wav_iter_begin(wav_iter* it, const wav_reader* r, u64 window_frames);
+// Points frames at the next window, returns its frame count (0 at the end)
+u64 wav_iter_next(wav_iter* it, const u8** frames);
+
+#endif